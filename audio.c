@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <endian.h>
+#include "audio.h"
 
 //The value of PI, since I need it sometimes
 const double PI = 3.14159265358979323846;
@@ -13,37 +14,16 @@ unsigned int SAMPLE_RATE = 48000;
 //When mixing a track, compress audio to this volume
 double VOLUME_MAX = 1;
 
-//A single audio sample
-typedef double Sample;
-
-//The type definition for an audio stream
-typedef struct {
-	Sample* samples;
-	unsigned int count;
-} Audio;
-
-//The possible waveforms for a note
-typedef enum {
-	SIN,
-	SQUARE,
-	TRIANGLE,
-	SAWTOOTH
-} Waveform;
-
-//The representation of a single note
-typedef struct {
-	double time; //Start time in seconds
-	Waveform waveform; //The type of note
-	double frequency; //Frequency in hertz
-	double volume; //Volume from 0 to 1
-	double duration; //Duration in seconds
-} Note;
-
-//The representation of a track
-typedef struct {
-	Note* notes;
-	unsigned int count;
-} Track;
+//Each note render is counted as a stage when built with -DAUDIO_METRICS,
+//audio_test.c includes this file directly and goes without
+#ifdef AUDIO_METRICS
+#include "metrics.h"
+#define AUDIO_NOTE_BEGIN() MetricsSample note_sample; metrics_stage_begin(&note_sample)
+#define AUDIO_NOTE_END() metrics_stage_end(STAGE_NOTE, &note_sample)
+#else
+#define AUDIO_NOTE_BEGIN()
+#define AUDIO_NOTE_END()
+#endif
 
 
 //Initialize an audio stream with a number of samples
@@ -187,7 +167,9 @@ void track_audio_preallocated(const Track* track, Audio* audio) {
 	for (i = 0; i < track->count; ++i) {
 		Note* note = &track->notes[i];
 		unsigned int notetime = (note->time * SAMPLE_RATE);
+		AUDIO_NOTE_BEGIN();
 		note_audio_preallocated(note, audio, notetime);
+		AUDIO_NOTE_END();
 	}
 	
 	//Clip the out of range samples
@@ -0,0 +1,64 @@
+#ifndef H_AUDIO_H
+#define H_AUDIO_H
+
+//The value of PI, since I need it sometimes
+extern const double PI;
+//Samples per second, one rate for the whole process
+extern unsigned int SAMPLE_RATE;
+//When mixing a track, compress audio to this volume
+extern double VOLUME_MAX;
+
+//A single audio sample
+typedef double Sample;
+
+//The type definition for an audio stream
+typedef struct {
+	Sample* samples;
+	unsigned int count;
+} Audio;
+
+//The possible waveforms for a note
+typedef enum {
+	SIN,
+	SQUARE,
+	TRIANGLE,
+	SAWTOOTH
+} Waveform;
+
+//The representation of a single note
+typedef struct {
+	double time; //Start time in seconds
+	Waveform waveform; //The type of note
+	double frequency; //Frequency in hertz
+	double volume; //Volume from 0 to 1
+	double duration; //Duration in seconds
+} Note;
+
+//The representation of a track
+typedef struct {
+	Note* notes;
+	unsigned int count;
+} Track;
+
+Audio audio_initialize(const unsigned int length);
+void audio_free(const Audio* audio);
+double audio_duration(const Audio* audio);
+double wave_sample_sin(double time, double frequency);
+double wave_sample_square(double time, double frequency);
+double wave_sample_triangle(double time, double frequency);
+double wave_sample_sawtooth(double time, double frequency);
+Note note_initialize();
+void note_free(const Note* note);
+unsigned int note_samples(const Note* note);
+void note_audio_preallocated(const Note* note, Audio* audio, const unsigned int start);
+Audio note_audio(const Note* note);
+Track track_initialize(unsigned int length);
+void track_free(const Track* track);
+double track_duration(const Track* track);
+unsigned int track_samples(const Track* track);
+void track_audio_preallocated(const Track* track, Audio* audio);
+Audio track_audio(const Track* track);
+Track track_initialize_from_binary(const char* data, const unsigned int size,
+	const double timemax, const double durationmax, const double frequencymax);
+void audio_save(const Audio* audio, const char* path);
+#endif
@@ -0,0 +1,567 @@
+/// bench.c
+//Microbenchmarks for synthesis, comparison and the genetic operators
+//Needs neither MPI nor an input file, run as ./bench [repeats] [longest song in seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <fftw3.h>
+#include "audio.h"
+#include "comparison.h"
+#include "evaluation.h"
+#include "pgenalg.h"
+#include "selection.h"
+
+#define SAMPLE_SECONDS 0.05 //each repeat runs the operation for at least this long
+#define POOL_SIZE 64 //chromosomes cycled through by the operator benchmarks
+#define QUALITY_STEPS 32 //candidates, each further from the goal's genome, in the search quality check
+
+//A timed operation, run iterations times per repeat
+typedef struct {
+	char name[64];
+	void (*run)(void* context, long iterations);
+	void* context;
+	double units; //work done by one operation, for throughput
+	const char* unit;
+} Benchmark;
+
+int repeats = 5;
+double max_song_seconds = 300;
+double note_max_duration = 0.1;
+double frequency_max = 25000;
+volatile double sink;//results land here so the work isn't optimized away
+
+double now(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+double time_run(const Benchmark* benchmark, long iterations){
+	double start = now();
+	benchmark->run(benchmark->context, iterations);
+	return now() - start;
+}
+
+void bench(const Benchmark* benchmark){
+	//find how many iterations fill a repeat, then report the spread of ns/op across repeats
+	long iterations = 1;
+	int i;
+	while(time_run(benchmark, iterations) < SAMPLE_SECONDS && iterations < (1L << 40)){
+		iterations *= 2;
+	}
+	double* ns = malloc(repeats * sizeof(double));
+	double mean = 0, variance = 0;
+	for(i=0; i<repeats; i++){
+		ns[i] = time_run(benchmark, iterations) * 1e9 / iterations;
+		mean += ns[i] / repeats;
+	}
+	for(i=0; i<repeats; i++){
+		variance += (ns[i] - mean) * (ns[i] - mean) / repeats;
+	}
+	qsort(ns, repeats, sizeof(double), compare_doubles);
+	double median = (repeats % 2) ? ns[repeats / 2] : (ns[repeats / 2 - 1] + ns[repeats / 2]) / 2;
+	printf("%-34s %14.1f %14.1f %7.2f%% %12.4g %s/s\n", benchmark->name, median, ns[0],
+		(mean > 0) ? 100 * sqrt(variance) / mean : 0.0, benchmark->units * 1e9 / median, benchmark->unit);
+	fflush(stdout);
+	free(ns);
+}
+
+void random_genes(chromosome* chromo, int notes){
+	//fill a chromosome with random notes, the way pgenalg starts a population
+	int i;
+	chromo->fitness = 0;
+	chromo->length = notes * NOTE_BYTES;
+	for(i=0; i<chromo->length; i++){
+		chromo->genes[i] = (char)randr(0,255);
+	}
+}
+
+/* rendering one note of each waveform */
+
+typedef struct {
+	Note note;
+	Audio audio;
+} NoteContext;
+
+void run_note(void* context, long iterations){
+	NoteContext* c = (NoteContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		note_audio_preallocated(&c->note, &c->audio, 0);
+	}
+	sink = c->audio.samples[0];
+}
+
+/* decoding and rendering whole tracks */
+
+typedef struct {
+	chromosome chromo;
+	double duration;
+	Track track;
+	Audio audio;
+} TrackContext;
+
+void run_decode(void* context, long iterations){
+	TrackContext* c = (TrackContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		Track track = track_initialize_from_binary(c->chromo.genes, c->chromo.length,
+			c->duration, note_max_duration, frequency_max);
+		sink = track.notes[0].frequency;
+		track_free(&track);
+	}
+}
+
+void run_track(void* context, long iterations){
+	TrackContext* c = (TrackContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		track_audio_preallocated(&c->track, &c->audio);
+	}
+	sink = c->audio.samples[0];
+}
+
+/* spectra and comparison against a goal */
+
+typedef struct {
+	Audio audio;
+	double* fftw_in;
+	fftw_complex* fftw_out;
+	fftw_plan plan;
+	double** goal;
+	int goal_size;
+	double* goal_bands;
+	int goal_blocks;
+	int edges[BAND_COUNT + 1];
+	double* band_scratch;
+	SparseGoal sparse;
+	double* sparse_scratch;
+} SpectrumContext;
+
+void free_spectrum(double** spectrum, int size){
+	int i;
+	for(i=0; i<size; i++){
+		free(spectrum[i]);
+	}
+	free(spectrum);
+}
+
+void run_spectrum(void* context, long iterations){
+	SpectrumContext* c = (SpectrumContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		double** test = NULL;
+		int size = PassAudioData(c->audio.samples, c->audio.count, &test, &c->fftw_in, &c->fftw_out, &c->plan);
+		sink = test[0][0];
+		free_spectrum(test, size);
+	}
+}
+
+void run_comparison(void* context, long iterations){
+	SpectrumContext* c = (SpectrumContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		sink = AudioComparison(c->audio.samples, c->audio.count, c->goal, c->goal_size, &c->fftw_in, &c->fftw_out, &c->plan);
+	}
+}
+
+void run_band_comparison(void* context, long iterations){
+	SpectrumContext* c = (SpectrumContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		sink = BandComparison(c->audio.samples, c->audio.count, c->goal_bands, c->goal_blocks, c->edges, c->band_scratch, &c->fftw_in, &c->fftw_out, &c->plan);
+	}
+}
+
+void run_sparse_comparison(void* context, long iterations){
+	SpectrumContext* c = (SpectrumContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		sink = SparseComparison(c->audio.samples, c->audio.count, &c->sparse, c->sparse_scratch, &c->fftw_in, &c->fftw_out, &c->plan);
+	}
+}
+
+void free_spectrum_context(SpectrumContext* c){
+	//release one song's goal, its bands and sparse index, their scratch and the audio, ready for the next
+	free_spectrum(c->goal, c->goal_size);
+	free(c->goal_bands);
+	free(c->band_scratch);
+	SparseGoalFree(&c->sparse);
+	free(c->sparse_scratch);
+	audio_free(&c->audio);
+	c->goal = NULL;
+	c->goal_size = 0;
+	c->goal_bands = NULL;
+	c->band_scratch = NULL;
+	c->sparse_scratch = NULL;
+	c->audio.samples = NULL;
+}
+
+void render_genes(Audio* audio, int notes){
+	//render random notes over the whole of audio, the way a goal made from music would sound
+	chromosome chromo;
+	random_genes(&chromo, notes);
+	Track track = track_initialize_from_binary(chromo.genes, chromo.length, audio->count * 1.0 / SAMPLE_RATE,
+		note_max_duration, frequency_max);
+	track_audio_preallocated(&track, audio);
+	track_free(&track);
+}
+
+/* whole genomes through the evaluation library */
+
+typedef struct {
+	EvaluationContext context;
+	const char* genomes[POOL_SIZE];
+	int lengths[POOL_SIZE];
+	double fitness[POOL_SIZE];
+} BatchContext;
+
+void run_batch(void* context, long iterations){
+	BatchContext* c = (BatchContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		evaluation_batch(&c->context, c->genomes, c->lengths, POOL_SIZE, c->fitness);
+	}
+	sink = c->fitness[0];
+}
+
+/* how well each fitness mode tracks closeness to the goal */
+
+void rank(const double* values, double* ranks, int n){
+	//ranks of values from 0, ties sharing their mean rank
+	int i, j;
+	for(i=0; i<n; i++){
+		int below = 0, equal = 0;
+		for(j=0; j<n; j++){
+			if(values[j] < values[i]) below++;
+			else if(values[j] == values[i]) equal++;
+		}
+		ranks[i] = below + (equal - 1) / 2.0;
+	}
+}
+
+double rank_correlation(const double* x, const double* y, int n){
+	//Spearman's rank correlation of x and y
+	double* rx = malloc(n * sizeof(double));
+	double* ry = malloc(n * sizeof(double));
+	double mean = (n - 1) / 2.0, xy = 0, xx = 0, yy = 0;
+	int i;
+	rank(x, rx, n);
+	rank(y, ry, n);
+	for(i=0; i<n; i++){
+		xy += (rx[i] - mean) * (ry[i] - mean);
+		xx += (rx[i] - mean) * (rx[i] - mean);
+		yy += (ry[i] - mean) * (ry[i] - mean);
+	}
+	free(rx);
+	free(ry);
+	return (xx > 0 && yy > 0) ? xy / sqrt(xx * yy) : 0;
+}
+
+void search_quality(double seconds){
+	/*
+	
+	Render a random genome as the goal, then score copies of it with more
+	and more of their notes replaced. A fitness that guides the search well
+	ranks the copies in the order they were changed, so each mode's
+	difference is rank-correlated with the number of notes replaced.
+	
+	*/
+	int i, j, notes = 150;
+	chromosome truth, candidate;
+	random_genes(&truth, notes);
+	Track track = track_initialize_from_binary(truth.genes, truth.length, seconds, note_max_duration, frequency_max);
+	Audio audio = audio_initialize(seconds * SAMPLE_RATE);
+	track_audio_preallocated(&track, &audio);
+	EvaluationGoal goals[3];
+	EvaluationContext contexts[3];
+	const FitnessMode modes[3] = {FITNESS_BINS, FITNESS_BANDS, FITNESS_SPARSE};
+	memset(goals, 0, sizeof(goals));
+	memset(contexts, 0, sizeof(contexts));
+	for(i=0; i<3; i++){
+		if(!evaluation_goal_from_audio(&goals[i], &audio, note_max_duration, frequency_max)
+			|| !evaluation_goal_set_mode(&goals[i], modes[i])
+			|| !evaluation_initialize(&contexts[i], &goals[i], NULL)) goto cleanup;
+	}
+	double changed[QUALITY_STEPS], difference[3][QUALITY_STEPS];
+	for(i=0; i<QUALITY_STEPS; i++){
+		candidate = truth;
+		changed[i] = (double)notes * i / (QUALITY_STEPS - 1);
+		for(j=0; j<(int)changed[i] * NOTE_BYTES; j++){
+			candidate.genes[j] = (char)randr(0,255);
+		}
+		for(j=0; j<3; j++){
+			difference[j][i] = evaluation_difference(&contexts[j], candidate.genes, candidate.length);
+		}
+	}
+	printf("search quality, %gs goal, rank correlation of difference with notes replaced (1 is ideal):\n", seconds);
+	for(i=0; i<3; i++){
+		printf("  %-32s %14.3f\n", evaluation_fitness_name(modes[i]), rank_correlation(changed, difference[i], QUALITY_STEPS));
+	}
+	printf("  %-32s %14.3f\n", "bins against bands", rank_correlation(difference[0], difference[1], QUALITY_STEPS));
+	printf("  %-32s %14.3f\n", "bins against sparse", rank_correlation(difference[0], difference[2], QUALITY_STEPS));
+
+cleanup:
+	for(i=0; i<3; i++){
+		evaluation_free(&contexts[i]);
+		evaluation_goal_free(&goals[i]);
+	}
+	track_free(&track);
+	audio_free(&audio);
+}
+
+/* genetic operators */
+
+typedef struct {
+	chromosome* pool;
+	chromosome out[2];
+	Selector selector;
+} OperatorContext;
+
+void run_mutate(void* context, long iterations){
+	OperatorContext* c = (OperatorContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		mutate(&c->pool[i % POOL_SIZE]);
+	}
+}
+
+void run_crossover(void* context, long iterations){
+	OperatorContext* c = (OperatorContext*)context;
+	long i;
+	for(i=0; i<iterations; i++){
+		one_point_crossover(c->pool[i % POOL_SIZE], c->pool[(i + 1) % POOL_SIZE], c->out);
+	}
+	sink = c->out[0].length;
+}
+
+void run_selection(void* context, long iterations){
+	OperatorContext* c = (OperatorContext*)context;
+	long i, total = 0;
+	for(i=0; i<iterations; i++){
+		total += selector_draw(&c->selector);
+	}
+	sink = total;
+}
+
+int main(int argc, char* argv[]){
+	if(argc > 1) repeats = atoi(argv[1]);
+	if(argc > 2) max_song_seconds = atof(argv[2]);
+	if(repeats < 1) repeats = 1;
+	srand48_r(1202107158, &drand_buf);
+	Benchmark b;
+	int i, j, status = 1;
+
+	//everything a failed step could leave behind is released once, at the end
+	SpectrumContext spectrum;
+	OperatorContext* operators = NULL;
+	BatchContext* batch = NULL;
+	EvaluationGoal goal;
+	Audio goal_audio;
+	memset(&spectrum, 0, sizeof(spectrum));
+	memset(&goal, 0, sizeof(goal));
+	memset(&goal_audio, 0, sizeof(goal_audio));
+
+	printf("%-34s %14s %14s %8s %12s\n", "benchmark", "median ns/op", "min ns/op", "stddev", "throughput");
+
+	//each waveform kernel at a few note lengths
+	const Waveform waveforms[4] = {SIN, SQUARE, TRIANGLE, SAWTOOTH};
+	const char* waveform_names[4] = {"sin", "square", "triangle", "sawtooth"};
+	const double note_lengths[3] = {0.01, 0.1, 1.0};
+	NoteContext note_context;
+	note_context.note = note_initialize();
+	note_context.audio = audio_initialize(SAMPLE_RATE);
+	for(i=0; i<4; i++){
+		for(j=0; j<3; j++){
+			note_context.note.waveform = waveforms[i];
+			note_context.note.duration = note_lengths[j];
+			snprintf(b.name, sizeof(b.name), "note %s %gs", waveform_names[i], note_lengths[j]);
+			b.run = run_note;
+			b.context = &note_context;
+			b.units = note_samples(&note_context.note);
+			b.unit = "samples";
+			bench(&b);
+		}
+	}
+	audio_free(&note_context.audio);
+
+	//decoding and rendering tracks up to a full chromosome
+	const int track_notes[3] = {50, 150, MAX_GENES / NOTE_BYTES};
+	TrackContext* track_context = malloc(sizeof(TrackContext));
+	track_context->duration = 10;
+	track_context->audio = audio_initialize(track_context->duration * SAMPLE_RATE);
+	for(i=0; i<3; i++){
+		random_genes(&track_context->chromo, track_notes[i]);
+		track_context->track = track_initialize_from_binary(track_context->chromo.genes, track_context->chromo.length,
+			track_context->duration, note_max_duration, frequency_max);
+
+		snprintf(b.name, sizeof(b.name), "track_initialize_from_binary %d", track_notes[i]);
+		b.run = run_decode;
+		b.context = track_context;
+		b.units = track_notes[i];
+		b.unit = "notes";
+		bench(&b);
+
+		snprintf(b.name, sizeof(b.name), "track_audio_preallocated %d", track_notes[i]);
+		b.run = run_track;
+		bench(&b);
+		track_free(&track_context->track);
+	}
+	audio_free(&track_context->audio);
+	free(track_context);
+
+	//spectrum and comparison of random audio against a random goal of the same length
+	const double song_lengths[3] = {10, 60, 300};
+	spectrum.fftw_in = fftw_malloc(sizeof(double) * blockSize);
+	spectrum.fftw_out = fftw_malloc(sizeof(fftw_complex) * blockSize);
+	spectrum.plan = fftw_plan_dft_r2c_1d(blockSize, spectrum.fftw_in, spectrum.fftw_out, FFTW_MEASURE);
+	for(i=0; i<3; i++){
+		if(song_lengths[i] > max_song_seconds) continue;
+		unsigned int k, count = song_lengths[i] * SAMPLE_RATE;
+		spectrum.audio = audio_initialize(count);
+		for(k=0; k<count; k++){
+			spectrum.audio.samples[k] = 2 * randv() - 1;
+		}
+		spectrum.goal_size = PassAudioData(spectrum.audio.samples, count, &spectrum.goal,
+			&spectrum.fftw_in, &spectrum.fftw_out, &spectrum.plan);
+		for(k=0; k<count; k++){
+			spectrum.audio.samples[k] = 2 * randv() - 1;
+		}
+
+		snprintf(b.name, sizeof(b.name), "PassAudioData %gs", song_lengths[i]);
+		b.run = run_spectrum;
+		b.context = &spectrum;
+		b.units = count;
+		b.unit = "samples";
+		bench(&b);
+
+		snprintf(b.name, sizeof(b.name), "AudioComparison %gs", song_lengths[i]);
+		b.run = run_comparison;
+		bench(&b);
+
+		BandEdges(spectrum.edges);
+		spectrum.goal_blocks = GoalBands(spectrum.goal, spectrum.goal_size, spectrum.edges, &spectrum.goal_bands);
+		spectrum.band_scratch = malloc(sizeof(double) * BandScratchSize(count));
+		snprintf(b.name, sizeof(b.name), "BandComparison %gs", song_lengths[i]);
+		b.run = run_band_comparison;
+		bench(&b);
+		printf("%-34s %14.0f %14.0f\n", "  goal bytes, bins and bands", (double)spectrum.goal_size * (2 * sizeof(double) + sizeof(double*)),
+			(double)spectrum.goal_blocks * BAND_COUNT * sizeof(double));
+
+		//noise is the worst case for a sparse goal, every bin is significant
+		if(!SparseGoalFromSpectrum(spectrum.goal, spectrum.goal_size, SPARSE_THRESHOLD, blockSize / 2, &spectrum.sparse)) goto cleanup;
+		spectrum.sparse_scratch = malloc(sizeof(double) * SparseScratchSize(count, &spectrum.sparse));
+		snprintf(b.name, sizeof(b.name), "SparseComparison %gs noise", song_lengths[i]);
+		b.run = run_sparse_comparison;
+		bench(&b);
+		free_spectrum_context(&spectrum);
+	}
+
+	//and against a goal rendered from notes, where only the bins the notes sound in are indexed
+	unsigned int rendered = 10 * SAMPLE_RATE;
+	spectrum.audio = audio_initialize(rendered);
+	render_genes(&spectrum.audio, 150);
+	spectrum.goal_size = PassAudioData(spectrum.audio.samples, rendered, &spectrum.goal,
+		&spectrum.fftw_in, &spectrum.fftw_out, &spectrum.plan);
+	if(!SparseGoalFromSpectrum(spectrum.goal, spectrum.goal_size, SPARSE_THRESHOLD, blockSize / 2, &spectrum.sparse)) goto cleanup;
+	spectrum.sparse_scratch = malloc(sizeof(double) * SparseScratchSize(rendered, &spectrum.sparse));
+	render_genes(&spectrum.audio, 150);
+	b.context = &spectrum;
+	b.units = rendered;
+	b.unit = "samples";
+	snprintf(b.name, sizeof(b.name), "AudioComparison 10s notes");
+	b.run = run_comparison;
+	bench(&b);
+	snprintf(b.name, sizeof(b.name), "SparseComparison 10s notes");
+	b.run = run_sparse_comparison;
+	bench(&b);
+	printf("%-34s %13.2f%%\n", "  significant bins", 100.0 * spectrum.sparse.offsets[spectrum.sparse.blocks] / spectrum.goal_size);
+	free_spectrum_context(&spectrum);
+
+	//operators on chromosomes sized like a starting population
+	operators = malloc(sizeof(OperatorContext));
+	operators->pool = malloc(POOL_SIZE * sizeof(chromosome));
+	for(i=0; i<POOL_SIZE; i++){
+		random_genes(&operators->pool[i], randr(150,250));
+	}
+
+	//scoring that population against a random 10 second goal, a batch at a time
+	goal_audio = audio_initialize(10 * SAMPLE_RATE);
+	for(i=0; i<(int)goal_audio.count; i++){
+		goal_audio.samples[i] = 2 * randv() - 1;
+	}
+	batch = calloc(1, sizeof(BatchContext));
+	if(!evaluation_goal_from_audio(&goal, &goal_audio, note_max_duration, frequency_max)
+		|| !evaluation_initialize(&batch->context, &goal, NULL)) goto cleanup;
+	for(i=0; i<POOL_SIZE; i++){
+		batch->genomes[i] = operators->pool[i].genes;
+		batch->lengths[i] = operators->pool[i].length;
+	}
+	snprintf(b.name, sizeof(b.name), "evaluation_batch %d x 10s", POOL_SIZE);
+	b.run = run_batch;
+	b.context = batch;
+	b.units = POOL_SIZE;
+	b.unit = "genomes";
+	bench(&b);
+	//contexts are sized for their goal's mode, so make a new one for bands
+	evaluation_free(&batch->context);
+	if(!evaluation_goal_set_mode(&goal, FITNESS_BANDS)
+		|| !evaluation_initialize(&batch->context, &goal, NULL)) goto cleanup;
+	snprintf(b.name, sizeof(b.name), "evaluation_batch %d x 10s bands", POOL_SIZE);
+	bench(&b);
+	search_quality(5);
+
+	snprintf(b.name, sizeof(b.name), "mutate");
+	b.run = run_mutate;
+	b.context = operators;
+	b.units = 1;
+	b.unit = "chromosomes";
+	bench(&b);
+
+	snprintf(b.name, sizeof(b.name), "one_point_crossover");
+	b.run = run_crossover;
+	b.unit = "pairs";
+	bench(&b);
+
+	//parent draws from a population of 1000 with each scheme
+	const SelectionScheme schemes[3] = {SELECT_TOURNAMENT, SELECT_RANK, SELECT_ROULETTE};
+	for(i=0; i<3; i++){
+		int ready = selector_initialize(&operators->selector, schemes[i], 8, 1000, 1);
+		if(ready){
+			for(j=0; j<1000; j++){
+				operators->selector.fitness[j] = 100 + 50 * randv();
+			}
+			selector_build_slice(&operators->selector, 0, 0, 1000);
+			selector_finish(&operators->selector, 0);
+			snprintf(b.name, sizeof(b.name), "selection %s n=1000", selection_scheme_name(schemes[i]));
+			b.run = run_selection;
+			b.unit = "parents";
+			bench(&b);
+		}
+		selector_free(&operators->selector);
+		if(!ready) goto cleanup;
+	}
+	status = 0;
+
+cleanup:
+	free_spectrum_context(&spectrum);
+	if(spectrum.plan) fftw_destroy_plan(spectrum.plan);
+	fftw_free(spectrum.fftw_in);
+	fftw_free(spectrum.fftw_out);
+	if(batch) evaluation_free(&batch->context);
+	free(batch);
+	evaluation_goal_free(&goal);
+	audio_free(&goal_audio);
+	if(operators) free(operators->pool);
+	free(operators);
+	return status;
+}
@@ -0,0 +1,268 @@
+/// checkpoint.c
+//Checkpoint and restart of the distributed population through MPI-IO
+#include <stdio.h>
+#include <string.h>
+#include "checkpoint.h"
+#include "migration.h"
+
+void checkpoint_initialize(Checkpoint* checkpoint) {
+	memset(checkpoint, 0, sizeof(Checkpoint));
+	checkpoint->type = MPI_DATATYPE_NULL;
+}
+
+//Size of the header plus the block table for a number of ranks
+static long long table_bytes(int ranks) {
+	return sizeof(CheckpointHeader) + ranks * sizeof(CheckpointBlock);
+}
+
+//A committed type covering bytes contiguous bytes, as whole 1 GiB chunks and then the rest,
+//so one rank's block can be read or written in one call however large it is
+static MPI_Datatype byte_run(long long bytes) {
+	const long long chunk = 1 << 30;
+	MPI_Datatype chunk_type, chunks, type;
+	MPI_Type_contiguous((int)chunk, MPI_BYTE, &chunk_type);
+	MPI_Type_contiguous((int)(bytes / chunk), chunk_type, &chunks);
+	int lengths[2] = {1, (int)(bytes % chunk)};
+	MPI_Aint displacements[2] = {0, (MPI_Aint)(bytes - bytes % chunk)};
+	MPI_Datatype types[2] = {chunks, MPI_BYTE};
+	MPI_Type_create_struct(2, lengths, displacements, types, &type);
+	MPI_Type_commit(&type);
+	MPI_Type_free(&chunk_type);
+	MPI_Type_free(&chunks);
+	return type;
+}
+
+/*
+
+Start writing a checkpoint. The population and rngs are packed into a
+private buffer before returning, so the caller can carry on evolving while
+MPI-IO writes it out. Everything goes to <path>.tmp, which replaces <path>
+once complete, so a job killed mid-write still has its previous checkpoint.
+Collective over comm, and every rank returns 0 if any rank couldn't
+start its part.
+
+*/
+int checkpoint_write(Checkpoint* checkpoint, const char* path, const CheckpointHeader* header,
+	const chromosome* population, int count, const struct drand48_data* rngs, int nrngs, MPI_Comm comm)
+{
+	int rank, ranks, i;
+	checkpoint_finish(checkpoint);
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &ranks);
+
+	//pack this rank's block
+	long long bytes = nrngs * sizeof(struct drand48_data) + sizeof(int);
+	for (i = 0; i < count; ++i) {
+		bytes += chromosome_packed_size(&population[i]);
+	}
+	chromosome** pointers = malloc(count * sizeof(chromosome*));
+	checkpoint->buffer = malloc(bytes);
+	int allocated = (pointers && checkpoint->buffer);
+	MPI_Allreduce(MPI_IN_PLACE, &allocated, 1, MPI_INT, MPI_MIN, comm);
+	if (!allocated) {
+		if (!pointers || !checkpoint->buffer) printf("error: could not allocate checkpoint buffer\n");
+		free(pointers);
+		free(checkpoint->buffer);
+		checkpoint->buffer = NULL;
+		return 0;
+	}
+	memcpy(checkpoint->buffer, rngs, nrngs * sizeof(struct drand48_data));
+	for (i = 0; i < count; ++i) {
+		pointers[i] = (chromosome*)&population[i];
+	}
+	chromosome_pack(pointers, count, checkpoint->buffer + nrngs * sizeof(struct drand48_data));
+	free(pointers);
+
+	//blocks follow the table in rank order
+	long long offset = 0;
+	MPI_Exscan(&bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+	if (rank == 0) offset = 0;
+	offset += table_bytes(ranks);
+	CheckpointBlock block;
+	block.offset = offset;
+	block.bytes = bytes;
+	block.count = count;
+	if (rank == 0) {
+		checkpoint->blocks = malloc(ranks * sizeof(CheckpointBlock));
+	}
+	MPI_Gather(&block, sizeof(CheckpointBlock), MPI_BYTE, checkpoint->blocks,
+		sizeof(CheckpointBlock), MPI_BYTE, 0, comm);
+
+	snprintf(checkpoint->path, sizeof(checkpoint->path), "%s", path);
+	snprintf(checkpoint->temp_path, sizeof(checkpoint->temp_path), "%s.tmp", path);
+	if (MPI_File_open(comm, checkpoint->temp_path, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+		MPI_INFO_NULL, &checkpoint->file) != MPI_SUCCESS) {
+		if (rank == 0) printf("error: could not open checkpoint %s\n", checkpoint->temp_path);
+		free(checkpoint->buffer);
+		free(checkpoint->blocks);
+		checkpoint->buffer = NULL;
+		checkpoint->blocks = NULL;
+		return 0;
+	}
+	checkpoint->comm = comm;
+	checkpoint->active = 1;
+	checkpoint->nrequests = 0;
+	checkpoint->type = byte_run(bytes);
+
+	MPI_File_iwrite_at_all(checkpoint->file, offset, checkpoint->buffer, 1, checkpoint->type,
+		&checkpoint->requests[checkpoint->nrequests++]);
+	if (rank == 0) {
+		//header and table share one buffer so they go out in one write
+		char* table = malloc(table_bytes(ranks));
+		checkpoint->header = *header;
+		memcpy(checkpoint->header.magic, CHECKPOINT_MAGIC, sizeof(checkpoint->header.magic));
+		checkpoint->header.version = CHECKPOINT_VERSION;
+		checkpoint->header.ranks = ranks;
+		checkpoint->header.rngs_per_rank = nrngs;
+		memcpy(table, &checkpoint->header, sizeof(CheckpointHeader));
+		memcpy(table + sizeof(CheckpointHeader), checkpoint->blocks, ranks * sizeof(CheckpointBlock));
+		free(checkpoint->blocks);
+		checkpoint->blocks = (CheckpointBlock*)table;
+		MPI_File_iwrite_at(checkpoint->file, 0, table, (int)table_bytes(ranks), MPI_BYTE,
+			&checkpoint->requests[checkpoint->nrequests++]);
+	}
+	return 1;
+}
+
+//Wait for a write in progress and move the file into place, leaving the previous checkpoint
+//if any rank's write failed. Collective over the writing comm, returns 0 if the write failed
+int checkpoint_finish(Checkpoint* checkpoint) {
+	int rank, written;
+	if (!checkpoint->active) return 1;
+	written = (MPI_Waitall(checkpoint->nrequests, checkpoint->requests, MPI_STATUSES_IGNORE) == MPI_SUCCESS);
+	MPI_File_close(&checkpoint->file);
+	MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_INT, MPI_MIN, checkpoint->comm);
+	MPI_Comm_rank(checkpoint->comm, &rank);
+	if (rank == 0 && !written) {
+		printf("error: could not write checkpoint %s\n", checkpoint->temp_path);
+	}
+	else if (rank == 0 && rename(checkpoint->temp_path, checkpoint->path) != 0) {
+		printf("error: could not move checkpoint to %s\n", checkpoint->path);
+		written = 0;
+	}
+	MPI_Type_free(&checkpoint->type);
+	free(checkpoint->buffer);
+	free(checkpoint->blocks);
+	checkpoint->buffer = NULL;
+	checkpoint->blocks = NULL;
+	checkpoint->active = 0;
+	return written;
+}
+
+//Whether ok holds on every rank of comm, so they all give up together
+static int all_ranks(int ok, MPI_Comm comm) {
+	int all = ok;
+	MPI_Allreduce(&ok, &all, 1, MPI_INT, MPI_MIN, comm);
+	return all;
+}
+
+//Read one rank's block, returns a buffer to free or NULL if it can't be allocated
+static char* read_block(MPI_File file, const CheckpointBlock* block) {
+	char* buffer = malloc(block->bytes);
+	if (!buffer) return NULL;
+	MPI_Datatype type = byte_run(block->bytes);
+	MPI_File_read_at(file, block->offset, buffer, 1, type, MPI_STATUS_IGNORE);
+	MPI_Type_free(&type);
+	return buffer;
+}
+
+/*
+
+Load a checkpoint into population[0, count). When the rank count and
+layout match the writer's, each rank gets its own block back along with
+its rngs. Otherwise all saved chromosomes are treated as one list, and
+rank r takes entries r*count onwards, wrapping round, so the population
+can be resumed on any number of ranks. rngs_restored is set when the
+rngs could be restored too. Collective over comm, and fails on every
+rank if reading fails on any.
+
+*/
+int checkpoint_read(const char* path, CheckpointHeader* header, chromosome* population, int count,
+	struct drand48_data* rngs, int nrngs, int* rngs_restored, MPI_Comm comm)
+{
+	int rank, ranks, i;
+	MPI_File file;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &ranks);
+	*rngs_restored = 0;
+	if (MPI_File_open(comm, (char*)path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+		if (rank == 0) printf("error: could not open checkpoint %s\n", path);
+		return 0;
+	}
+	MPI_File_read_at_all(file, 0, header, sizeof(CheckpointHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+	if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->version != CHECKPOINT_VERSION) {
+		if (rank == 0) printf("error: %s is not a checkpoint\n", path);
+		MPI_File_close(&file);
+		return 0;
+	}
+	CheckpointBlock* blocks = malloc(header->ranks * sizeof(CheckpointBlock));
+	if (!all_ranks(blocks != NULL, comm)) {
+		if (!blocks) printf("error: could not allocate the block table of checkpoint %s\n", path);
+		free(blocks);
+		MPI_File_close(&file);
+		return 0;
+	}
+	MPI_File_read_at_all(file, sizeof(CheckpointHeader), blocks,
+		header->ranks * sizeof(CheckpointBlock), MPI_BYTE, MPI_STATUS_IGNORE);
+	long long total = 0;
+	for (i = 0; i < header->ranks; ++i) {
+		total += blocks[i].count;
+	}
+	if (total == 0) {
+		if (rank == 0) printf("error: checkpoint %s is empty\n", path);
+		free(blocks);
+		MPI_File_close(&file);
+		return 0;
+	}
+
+	//blocks are read independently, so a rank that runs out of memory just stops and tells the others at the end
+	int ok = 1;
+	if (header->ranks == ranks && header->population_size == count && header->rngs_per_rank == nrngs) {
+		char* buffer = read_block(file, &blocks[rank]);
+		if (buffer) {
+			memcpy(rngs, buffer, nrngs * sizeof(struct drand48_data));
+			chromosome_unpack(buffer + nrngs * sizeof(struct drand48_data),
+				blocks[rank].bytes - nrngs * sizeof(struct drand48_data), population, count);
+			free(buffer);
+			*rngs_restored = 1;
+		}
+		ok = (buffer != NULL);
+	} else {
+		//walk the global list from this rank's start, loading one saved block at a time
+		int loaded = -1;
+		long long loaded_start = 0;
+		chromosome* saved = NULL;
+		long long first = ((long long)rank * count) % total;
+		for (i = 0; ok && i < count; ++i) {
+			long long index = (first + i) % total;
+			if (loaded < 0 || index < loaded_start || index >= loaded_start + blocks[loaded].count) {
+				long long start = 0;
+				int b = 0;
+				while (start + blocks[b].count <= index) {
+					start += blocks[b].count;
+					++b;
+				}
+				char* buffer = read_block(file, &blocks[b]);
+				free(saved);
+				saved = malloc(blocks[b].count * sizeof(chromosome));
+				if (!buffer || !saved) {
+					free(buffer);
+					ok = 0;
+					break;
+				}
+				int skip = header->rngs_per_rank * sizeof(struct drand48_data);
+				chromosome_unpack(buffer + skip, blocks[b].bytes - skip, saved, blocks[b].count);
+				free(buffer);
+				loaded = b;
+				loaded_start = start;
+			}
+			copy_chromosome(&population[i], &saved[index - loaded_start]);
+		}
+		free(saved);
+	}
+	if (!ok) printf("error: could not allocate memory to read checkpoint %s\n", path);
+
+	free(blocks);
+	MPI_File_close(&file);
+	return all_ranks(ok, comm);
+}
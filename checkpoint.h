@@ -0,0 +1,59 @@
+#ifndef H_CHECKPOINT_H
+#define H_CHECKPOINT_H
+#include <stdlib.h>
+#include <mpi.h>
+#include "pgenalg.h"
+
+#define CHECKPOINT_MAGIC "PGACKPT1"
+#define CHECKPOINT_VERSION 1
+
+/*
+
+Checkpoint file layout, native byte order:
+	CheckpointHeader
+	CheckpointBlock for each rank that wrote it
+	each rank's block: its rngs, then its population packed as in migration.c
+
+*/
+typedef struct {
+	char magic[8];
+	int version;
+	int ranks;
+	int rngs_per_rank; //main rng plus one per thread
+	int population_size; //per rank
+	int generation; //last generation completed
+	int max_generations;
+	int last_improvement;
+	double mutation_rate;
+	double crossover_rate;
+	double best_so_far;
+} CheckpointHeader;
+
+typedef struct {
+	long long offset;
+	long long bytes;
+	int count;
+} CheckpointBlock;
+
+//An asynchronous write in progress, finished by the next write or checkpoint_finish
+typedef struct {
+	int active;
+	MPI_File file;
+	MPI_Comm comm;
+	MPI_Request requests[2];
+	int nrequests;
+	MPI_Datatype type; //this rank's block, which may be more than INT_MAX bytes
+	char* buffer;
+	CheckpointHeader header;
+	CheckpointBlock* blocks;
+	char path[512];
+	char temp_path[520];
+} Checkpoint;
+
+void checkpoint_initialize(Checkpoint* checkpoint);
+int checkpoint_write(Checkpoint* checkpoint, const char* path, const CheckpointHeader* header,
+	const chromosome* population, int count, const struct drand48_data* rngs, int nrngs, MPI_Comm comm);
+int checkpoint_finish(Checkpoint* checkpoint);
+int checkpoint_read(const char* path, CheckpointHeader* header, chromosome* population, int count,
+	struct drand48_data* rngs, int nrngs, int* rngs_restored, MPI_Comm comm);
+#endif
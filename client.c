@@ -0,0 +1,100 @@
+/// client.c
+//Sends one run to a pgenalg --serve socket and prints what comes back
+//Run as ./pgenalg-client socket [--save=directory] arguments and options of the run, or ./pgenalg-client socket shutdown
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Copy bytes of a streamed snapshot from the server into out, or just skip them when out is NULL
+static int copy_bytes(FILE* server, FILE* out, long bytes) {
+	char buffer[65536];
+	while (bytes > 0) {
+		size_t chunk = (bytes < (long)sizeof(buffer)) ? (size_t)bytes : sizeof(buffer);
+		size_t got = fread(buffer, 1, chunk, server);
+		if (got == 0) return 0;
+		if (out) fwrite(buffer, 1, got, out);
+		bytes -= got;
+	}
+	return 1;
+}
+
+int main(int argc, char* argv[]) {
+	int i, first = 2;
+	const char* save = NULL;
+	if (argc < 3) {
+		printf("usage: %s socket [--save=directory] population_size max_generations threads_per_rank generations_between_wav_output input_file output_directory [options]\n", argv[0]);
+		printf("       %s socket shutdown\n", argv[0]);
+		return 2;
+	}
+	if (strncmp(argv[2], "--save=", 7) == 0) {
+		save = argv[2] + 7;
+		first = 3;
+	}
+
+	//the request is the run's arguments on one line
+	size_t length = 2;
+	for (i = first; i < argc; ++i) length += strlen(argv[i]) + 1;
+	char* request = malloc(length);
+	request[0] = '\0';
+	for (i = first; i < argc; ++i) {
+		strcat(request, argv[i]);
+		strcat(request, (i + 1 < argc) ? " " : "\n");
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", argv[1]);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		printf("error: could not connect to %s\n", argv[1]);
+		return 2;
+	}
+	if (write(fd, request, strlen(request)) != (ssize_t)strlen(request)) {
+		printf("error: could not send the request\n");
+		return 2;
+	}
+	free(request);
+
+	//lines are the run's output, apart from streamed snapshots and the closing status
+	FILE* server = fdopen(fd, "r");
+	char line[4096];
+	int status = -1;
+	while (fgets(line, sizeof(line), server)) {
+		long bytes;
+		char path[2048];
+		if (sscanf(line, "wav %ld %2047[^\n]", &bytes, path) == 2) {
+			FILE* out = NULL;
+			char saved[4096];
+			if (save) {
+				const char* name = strrchr(path, '/');
+				snprintf(saved, sizeof(saved), "%s/%s", save, name ? name + 1 : path);
+				out = fopen(saved, "wb");
+				if (!out) printf("error: could not save %s\n", saved);
+			}
+			int complete = copy_bytes(server, out, bytes);
+			if (out) {
+				fclose(out);
+				if (complete) printf("Saved %s\n", saved);
+			}
+			if (!complete) break;
+		}
+		else if (sscanf(line, "status %d", &status) == 1) {
+			break;
+		}
+		else {
+			fputs(line, stdout);
+			fflush(stdout);
+		}
+	}
+	fclose(server);
+	if (status < 0) {
+		printf("error: the server hung up before the run finished\n");
+		return 2;
+	}
+	return status;
+}
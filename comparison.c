@@ -6,6 +6,18 @@
 #include "fftw3.h"
 #include "comparison.h"
 
+//The FFT and comparison stages are timed when built with -DCOMPARISON_METRICS,
+//otherwise the hooks compile away and comparison.c links on its own
+#ifdef COMPARISON_METRICS
+#include "metrics.h"
+#else
+typedef int MetricsSample;
+#define metrics_start() 0.0
+#define metrics_stop(phase, start) ((void)(start))
+#define metrics_stage_begin(sample) ((void)(sample))
+#define metrics_stage_end(stage, sample) ((void)(sample))
+#endif
+
 sf_count_t blockSize = 512; //some code suggests its the size of each sample. Other code suggests its the number of samples. 256 is default.
 
 void PrintAudioMetadata(SF_INFO * file)
@@ -173,10 +185,13 @@ int PassAudioData(double* samples, int numSamples, double*** dft_data, double**
 double GetFitnessHelper(double** goal, double** test, int size){
 	double fitness = 0.0;
 	int i;
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
 	for(i = 0; i < size; i++){
 		fitness += ((abs(goal[i][0]) - abs(test[i][0])) * (abs(goal[i][0]) - abs(test[i][0])));
 		fitness += ((abs(goal[i][1]) - abs(test[i][1])) * (abs(goal[i][1]) - abs(test[i][1])));
 	}
+	metrics_stage_end(STAGE_COMPARE, &sample);
 	return fitness;
 }
 
@@ -193,12 +208,18 @@ double AudioComparison(double* samples, int numSamples, double** goal, int goals
 		return DBL_MAX;
 	}
 
+	double phase = metrics_start();
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
 	double** test = NULL;
 	int testsize = PassAudioData(samples, numSamples, &test, fftw_in, fftw_out, fftw_plan);
+	metrics_stage_end(STAGE_FFT, &sample);
+	metrics_stop(PHASE_FFT, phase);
 	if( !testsize ){
 		printf("PassAudioData failed!\n");
 		return DBL_MAX;
 	}
+	phase = metrics_start();
 
 	double fitness;
 	int i;
@@ -221,6 +242,283 @@ double AudioComparison(double* samples, int numSamples, double** goal, int goals
 		free(test[i]);
 	}
 	free(test);
+	metrics_stop(PHASE_COMPARE, phase);
+
+	return fitness;
+}
+
+void BandEdges(int* edges)
+{
+	//split the blockSize/2 bins of a block into BAND_COUNT bands, log-spaced but at least a bin wide
+	//edges has BAND_COUNT + 1 entries and band k is bins edges[k] to edges[k+1]
+	int bins = (int)(blockSize / 2);
+	int k;
+	edges[0] = 0;
+	for(k = 1; k <= BAND_COUNT; k++){
+		edges[k] = (int)pow(bins, k / (double)BAND_COUNT);
+		if(edges[k] <= edges[k-1]) edges[k] = edges[k-1] + 1;
+		if(edges[k] > bins - (BAND_COUNT - k)) edges[k] = bins - (BAND_COUNT - k);
+	}
+}
+
+void PoolBands(const double* bins, const int* edges, double* power, double* bands)
+{
+	//log energy of each band of one block, bins are interleaved re/im as fftw_out holds them
+	//power is scratch for blockSize/2 values, filled in one pass the compiler can vectorize
+	int bincount = (int)(blockSize / 2);
+	int j, k;
+	for(j = 0; j < bincount; j++){
+		power[j] = bins[2*j] * bins[2*j] + bins[2*j+1] * bins[2*j+1];
+	}
+	for(k = 0; k < BAND_COUNT; k++){
+		double energy = 0.0;
+		for(j = edges[k]; j < edges[k+1]; j++){
+			energy += power[j];
+		}
+		bands[k] = log1p(energy);
+	}
+}
+
+int GoalBands(double** spectrum, int size, const int* edges, double** bands)
+{
+	//pool a spectrum from ReadAudioFile or PassAudioData into bands, returns the number of blocks
+	int bincount = (int)(blockSize / 2);
+	int numBlocks = size / bincount;
+	int i, j;
+	double* bins = malloc(sizeof(double) * blockSize);
+	double* power = malloc(sizeof(double) * bincount);
+	(*bands) = malloc(sizeof(double) * numBlocks * BAND_COUNT);
+	if( !bins || !power || !(*bands) ){
+		printf("error: could not allocate goal bands\n");
+		free(bins);
+		free(power);
+		free(*bands);
+		(*bands) = NULL;
+		return 0;
+	}
+	for(i = 0; i < numBlocks; i++){
+		for(j = 0; j < bincount; j++){
+			bins[2*j] = spectrum[i*bincount + j][0];
+			bins[2*j+1] = spectrum[i*bincount + j][1];
+		}
+		PoolBands(bins, edges, power, (*bands) + i*BAND_COUNT);
+	}
+	free(bins);
+	free(power);
+	return numBlocks;
+}
+
+double GetBandFitnessHelper(const double* goal, const double* test, int size){
+	double fitness = 0.0;
+	int i;
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	for(i = 0; i < size; i++){
+		fitness += (goal[i] - test[i]) * (goal[i] - test[i]);
+	}
+	metrics_stage_end(STAGE_COMPARE, &sample);
+	return fitness;
+}
+
+int BandScratchSize(int numSamples)
+{
+	//doubles BandComparison needs as scratch, the bands of every block and one block's bin powers
+	return (int)(ceil(numSamples / (double)blockSize)) * BAND_COUNT + (int)(blockSize / 2);
+}
+
+double BandComparison(double* samples, int numSamples, const double* goal, int goalblocks, const int* edges, double* scratch, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan){
+	//like AudioComparison, but each block is pooled into its band energies straight from the fft
+	//goal holds BAND_COUNT log energies for each of its goalblocks blocks
+	//scratch holds BandScratchSize(numSamples) doubles, so nothing is allocated per call
+	if(!samples || numSamples == 0){
+		return DBL_MAX;
+	}
+	if(!goal || goalblocks == 0 || !scratch){
+		printf("error: goal bands not passed in correctly!\n");
+		return DBL_MAX;
+	}
+
+	double phase = metrics_start();
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	int numBlocks = (int)(ceil(numSamples / (double)blockSize));
+	double* test = scratch;
+	double* power = scratch + numBlocks * BAND_COUNT;
+	sf_count_t i, j;
+	for(i = 0; i < numBlocks; i++){
+		for(j = 0; j < blockSize; j++){
+			(*fftw_in)[j] = ((i*blockSize)+j < numSamples) ? samples[(i*blockSize)+j] : 0.0;
+		}
+		fftw_execute( (*fftw_plan) );
+		PoolBands((const double*)(*fftw_out), edges, power, test + i*BAND_COUNT);
+	}
+	metrics_stage_end(STAGE_FFT, &sample);
+	metrics_stop(PHASE_FFT, phase);
+	phase = metrics_start();
+
+	//blocks only one side has are compared with silence, which pools to 0
+	int common = (numBlocks < goalblocks) ? numBlocks : goalblocks;
+	double fitness = GetBandFitnessHelper(goal, test, common * BAND_COUNT);
+	for(i = common * BAND_COUNT; i < numBlocks * BAND_COUNT; i++){
+		fitness += test[i] * test[i];
+	}
+	for(i = common * BAND_COUNT; i < goalblocks * BAND_COUNT; i++){
+		fitness += goal[i] * goal[i];
+	}
+	metrics_stop(PHASE_COMPARE, phase);
+
+	return fitness;
+}
+
+int SparseGoalFromSpectrum(double** spectrum, int size, double threshold, int maxbin, SparseGoal* sparse)
+{
+	//index the bins below maxbin whose energy is at least threshold times the loudest bin's
+	//every other bin only adds to its block's rest, returns 0 on failure
+	int bincount = (int)(blockSize / 2);
+	int i, j, entries = 0;
+	double loudest = 0.0;
+	for(i = 0; i < size; i++){
+		double energy = spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+		if(energy > loudest) loudest = energy;
+	}
+	double cutoff = threshold * loudest;
+	if(maxbin > bincount) maxbin = bincount;
+	for(i = 0; i < size; i++){
+		double energy = spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+		if(i % bincount < maxbin && energy >= cutoff && energy > 0) entries++;
+	}
+	sparse->blocks = size / bincount;
+	sparse->offsets = malloc(sizeof(int) * (sparse->blocks + 1));
+	sparse->bins = malloc(sizeof(int) * (entries + 1));
+	sparse->values = malloc(sizeof(double) * 2 * (entries + 1));
+	sparse->rest = malloc(sizeof(double) * (sparse->blocks + 1));
+	if( !sparse->offsets || !sparse->bins || !sparse->values || !sparse->rest ){
+		printf("error: could not allocate the sparse goal\n");
+		SparseGoalFree(sparse);
+		return 0;
+	}
+	entries = 0;
+	for(i = 0; i < sparse->blocks; i++){
+		sparse->offsets[i] = entries;
+		sparse->rest[i] = 0.0;
+		for(j = 0; j < bincount; j++){
+			double* bin = spectrum[i*bincount + j];
+			double energy = bin[0] * bin[0] + bin[1] * bin[1];
+			if(j < maxbin && energy >= cutoff && energy > 0){
+				sparse->bins[entries] = j;
+				sparse->values[2*entries] = fabs(bin[0]);
+				sparse->values[2*entries+1] = fabs(bin[1]);
+				entries++;
+			}
+			else{
+				sparse->rest[i] += energy;
+			}
+		}
+	}
+	sparse->offsets[sparse->blocks] = entries;
+	return 1;
+}
+
+void SparseGoalFree(SparseGoal* sparse)
+{
+	free(sparse->offsets);
+	free(sparse->bins);
+	free(sparse->values);
+	free(sparse->rest);
+	sparse->offsets = NULL;
+	sparse->bins = NULL;
+	sparse->values = NULL;
+	sparse->rest = NULL;
+	sparse->blocks = 0;
+}
+
+double GetSparseFitnessHelper(const SparseGoal* goal, const double* test, const double* totals, int blocks){
+	//test holds |re| and |im| of the candidate at each goal entry, totals each candidate block's energy
+	//the bins left out are compared in closed form, as the goal's rest plus whatever energy the candidate has
+	//there, which drops the cross term the goal's near-silence makes small
+	double fitness = 0.0;
+	int i, e;
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	for(i = 0; i < blocks; i++){
+		double indexed = 0.0;
+		for(e = goal->offsets[i]; e < goal->offsets[i+1]; e++){
+			double re = goal->values[2*e] - test[2*e];
+			double im = goal->values[2*e+1] - test[2*e+1];
+			fitness += re * re + im * im;
+			indexed += test[2*e] * test[2*e] + test[2*e+1] * test[2*e+1];
+		}
+		double rest = totals[i] - indexed;
+		fitness += goal->rest[i] + ((rest > 0) ? rest : 0.0);
+	}
+	metrics_stage_end(STAGE_COMPARE, &sample);
+	return fitness;
+}
+
+int SparseScratchSize(int numSamples, const SparseGoal* goal)
+{
+	//doubles SparseComparison needs as scratch, the candidate at every goal entry and each block's energy
+	int numBlocks = (int)(ceil(numSamples / (double)blockSize));
+	int common = (numBlocks < goal->blocks) ? numBlocks : goal->blocks;
+	return 2 * (goal->offsets[common] + 1) + numBlocks;
+}
+
+double SparseComparison(double* samples, int numSamples, const SparseGoal* goal, double* scratch, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan){
+	//like AudioComparison, but only the goal's indexed bins are read out of each block's fft
+	//a block's energy over its blockSize/2 bins comes from its samples by Parseval's theorem:
+	//blockSize * sum x^2 covers all blockSize bins, half of which mirror the others apart from
+	//the DC bin (sum x) and the Nyquist bin (alternating sum of x), which are counted once
+	//scratch holds SparseScratchSize(numSamples, goal) doubles, so nothing is allocated per call
+	if(!samples || numSamples == 0){
+		return DBL_MAX;
+	}
+	if(!goal || goal->blocks == 0 || !scratch){
+		printf("error: sparse goal not passed in correctly!\n");
+		return DBL_MAX;
+	}
+
+	double phase = metrics_start();
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	int numBlocks = (int)(ceil(numSamples / (double)blockSize));
+	int common = (numBlocks < goal->blocks) ? numBlocks : goal->blocks;
+	double* test = scratch;
+	double* totals = scratch + 2 * (goal->offsets[common] + 1);
+	sf_count_t i, j;
+	int e;
+	for(i = 0; i < numBlocks; i++){
+		double energy = 0.0, dc = 0.0, nyquist = 0.0;
+		for(j = 0; j < blockSize; j++){
+			double x = ((i*blockSize)+j < numSamples) ? samples[(i*blockSize)+j] : 0.0;
+			(*fftw_in)[j] = x;
+			energy += x * x;
+			dc += x;
+			nyquist += (j & 1) ? -x : x;
+		}
+		totals[i] = (blockSize * energy + dc * dc - nyquist * nyquist) / 2;
+		if(i >= common) continue;
+		fftw_execute( (*fftw_plan) );
+		for(e = goal->offsets[i]; e < goal->offsets[i+1]; e++){
+			test[2*e] = fabs((*fftw_out)[goal->bins[e]][0]);
+			test[2*e+1] = fabs((*fftw_out)[goal->bins[e]][1]);
+		}
+	}
+	metrics_stage_end(STAGE_FFT, &sample);
+	metrics_stop(PHASE_FFT, phase);
+	phase = metrics_start();
+
+	//blocks only one side has are compared with silence
+	double fitness = GetSparseFitnessHelper(goal, test, totals, common);
+	for(i = common; i < numBlocks; i++){
+		fitness += totals[i];
+	}
+	for(i = common; i < goal->blocks; i++){
+		fitness += goal->rest[i];
+		for(e = goal->offsets[i]; e < goal->offsets[i+1]; e++){
+			fitness += goal->values[2*e] * goal->values[2*e] + goal->values[2*e+1] * goal->values[2*e+1];
+		}
+	}
+	metrics_stop(PHASE_COMPARE, phase);
 
 	return fitness;
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#ifndef H_COMPARISON_H
+#define H_COMPARISON_H
 #include "sndfile.h"
 #include "fftw3.h"
 
@@ -5,4 +7,28 @@ void PrintAudioMetadata(SF_INFO * file);
 int ReadAudioFile(char* filename, double*** dft_data, unsigned int* samplerate, unsigned int* frames);
 int PassAudioData(double* samples, int numSamples, double*** dft_data, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan);
 double GetFitnessHelper(double** goal, double** test, int size);
-double AudioComparison(double* samples, int numSamples, double** goal, int goalsize, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan);
\ No newline at end of file
+double AudioComparison(double* samples, int numSamples, double** goal, int goalsize, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan);
+//Log-spaced bands each block is pooled into for band comparisons
+#define BAND_COUNT 32
+void BandEdges(int* edges);
+void PoolBands(const double* bins, const int* edges, double* power, double* bands);
+int GoalBands(double** spectrum, int size, const int* edges, double** bands);
+double GetBandFitnessHelper(const double* goal, const double* test, int size);
+int BandScratchSize(int numSamples);
+double BandComparison(double* samples, int numSamples, const double* goal, int goalblocks, const int* edges, double* scratch, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan);
+//Significant bins of each goal block, with the energy of the others summed per block
+typedef struct {
+	int blocks;
+	int* offsets; //block i's entries are offsets[i] to offsets[i+1]
+	int* bins;
+	double* values; //|re| and |im| of each entry
+	double* rest; //energy of the bins left out of each block
+} SparseGoal;
+int SparseGoalFromSpectrum(double** spectrum, int size, double threshold, int maxbin, SparseGoal* sparse);
+void SparseGoalFree(SparseGoal* sparse);
+double GetSparseFitnessHelper(const SparseGoal* goal, const double* test, const double* totals, int blocks);
+int SparseScratchSize(int numSamples, const SparseGoal* goal);
+double SparseComparison(double* samples, int numSamples, const SparseGoal* goal, double* scratch, double** fftw_in, fftw_complex** fftw_out, fftw_plan* fftw_plan);
+//Samples in each block of a spectrum, defined in comparison.c
+extern sf_count_t blockSize;
+#endif
\ No newline at end of file
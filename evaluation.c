@@ -0,0 +1,376 @@
+/// evaluation.c
+//Decoding, rendering and scoring genomes against a goal spectrum
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include "sndfile.h"
+#include "evaluation.h"
+#include "metrics.h"
+
+//Blocks a goal worker reads from the file at a time
+#define GOAL_CHUNK_BLOCKS 64
+
+//FFTW's planner isn't thread-safe, every plan made here goes through this
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//A run of a goal's blocks for one worker to read and transform
+typedef struct {
+	EvaluationGoal* goal;
+	char* path;
+	int first;
+	int count;
+	int ok;
+} GoalSlice;
+
+static void goal_ranges(EvaluationGoal* goal, unsigned int samples, double note_max_duration, double frequency_max) {
+	goal->samples = samples;
+	goal->sample_rate = SAMPLE_RATE;
+	goal->duration = (samples * 1.0 / SAMPLE_RATE);
+	goal->note_max_duration = (goal->duration < note_max_duration) ? goal->duration : note_max_duration;
+	goal->frequency_max = frequency_max;
+}
+
+/*
+
+Read a mono .wav goal's header and make room for its spectrum, which
+also sets the process-wide SAMPLE_RATE. The spectrum is filled in by
+evaluation_goal_blocks, a run of blocks at a time, so the runs can be
+split between threads or processes and each one only reads its own part
+of the file. Returns 0 on failure.
+
+*/
+int evaluation_goal_open(EvaluationGoal* goal, char* path, double note_max_duration, double frequency_max) {
+	int i;
+	SF_INFO info;
+	memset(goal, 0, sizeof(EvaluationGoal));
+	memset(&info, 0, sizeof(info));
+	SNDFILE* file = sf_open(path, SFM_READ, &info);
+	if (!file) {
+		printf("error: could not open %s for processing\n", path);
+		return 0;
+	}
+	sf_close(file);
+	if (info.channels != 1) {
+		printf("error: .wav file must be Mono. Code can't handle multi-channel audio.\n");
+		return 0;
+	}
+	int blocks = (int)ceil(info.frames / (double)blockSize);
+	goal->size = blocks * (int)(blockSize / 2);
+	goal->values = malloc(sizeof(double) * blocks * blockSize);
+	goal->spectrum = malloc(sizeof(double*) * goal->size);
+	if (!goal->values || !goal->spectrum) {
+		printf("error: could not allocate the goal spectrum\n");
+		evaluation_goal_free(goal);
+		return 0;
+	}
+	for (i = 0; i < goal->size; ++i) {
+		goal->spectrum[i] = goal->values + 2 * (size_t)i;
+	}
+	SAMPLE_RATE = (unsigned int)info.samplerate;
+	goal_ranges(goal, (unsigned int)info.frames, note_max_duration, frequency_max);
+	return 1;
+}
+
+//Number of blockSize blocks of samples behind an opened goal's spectrum
+int evaluation_goal_block_count(const EvaluationGoal* goal) {
+	return goal->size / (int)(blockSize / 2);
+}
+
+//Stream one run of blocks through its own file handle and plan, writing their bins into the goal
+static void* transform_slice(void* input) {
+	GoalSlice* slice = input;
+	EvaluationGoal* goal = slice->goal;
+	int done, b;
+	sf_count_t j;
+	SF_INFO info;
+	memset(&info, 0, sizeof(info));
+	SNDFILE* file = sf_open(slice->path, SFM_READ, &info);
+	double* chunk = malloc(sizeof(double) * blockSize * GOAL_CHUNK_BLOCKS);
+	double* fftw_in = fftw_malloc(sizeof(double) * blockSize);
+	fftw_complex* fftw_out = fftw_malloc(sizeof(fftw_complex) * blockSize);
+	fftw_plan plan = NULL;
+	if (fftw_in && fftw_out) {
+		pthread_mutex_lock(&planner_lock);
+		plan = fftw_plan_dft_r2c_1d(blockSize, fftw_in, fftw_out, FFTW_MEASURE);
+		pthread_mutex_unlock(&planner_lock);
+	}
+	slice->ok = file && chunk && plan && sf_seek(file, slice->first * blockSize, SEEK_SET) >= 0;
+	for (done = 0; slice->ok && done < slice->count; done += GOAL_CHUNK_BLOCKS) {
+		int blocks = (slice->count - done < GOAL_CHUNK_BLOCKS) ? slice->count - done : GOAL_CHUNK_BLOCKS;
+		sf_count_t read = sf_readf_double(file, chunk, blocks * blockSize);
+		//the last block is padded with 0 so its fft is the same size as the others
+		for (j = (read > 0) ? read : 0; j < blocks * blockSize; ++j) {
+			chunk[j] = 0.0;
+		}
+		for (b = 0; b < blocks; ++b) {
+			memcpy(fftw_in, chunk + b * blockSize, sizeof(double) * blockSize);
+			fftw_execute(plan);
+			double* bins = goal->values + (size_t)(slice->first + done + b) * blockSize;
+			for (j = 0; j < blockSize / 2; ++j) {
+				bins[2 * j] = fftw_out[j][0];
+				bins[2 * j + 1] = fftw_out[j][1];
+			}
+		}
+	}
+	if (!slice->ok) printf("error: could not read %s for processing\n", slice->path);
+	if (plan) {
+		pthread_mutex_lock(&planner_lock);
+		fftw_destroy_plan(plan);
+		pthread_mutex_unlock(&planner_lock);
+	}
+	fftw_free(fftw_in);
+	fftw_free(fftw_out);
+	free(chunk);
+	if (file) sf_close(file);
+	return NULL;
+}
+
+/*
+
+Fill in count blocks of an opened goal starting at block first, split
+into contiguous runs over up to threads threads. Each thread reads its
+run from the file a chunk at a time and transforms it with its own plan,
+so reading and transforming both scale with the threads. Returns 0 on
+failure.
+
+*/
+int evaluation_goal_blocks(EvaluationGoal* goal, char* path, int first, int count, int threads) {
+	int i, ok = 1;
+	if (count <= 0) return 1;
+	if (threads > count) threads = count;
+	if (threads < 1) threads = 1;
+	pthread_t* workers = malloc(threads * sizeof(pthread_t));
+	GoalSlice* slices = malloc(threads * sizeof(GoalSlice));
+	for (i = 0; i < threads; ++i) {
+		slices[i].goal = goal;
+		slices[i].path = path;
+		slices[i].first = first + (int)((long long)count * i / threads);
+		slices[i].count = first + (int)((long long)count * (i + 1) / threads) - slices[i].first;
+		slices[i].ok = 0;
+		if (i > 0) pthread_create(&workers[i], NULL, transform_slice, &slices[i]);
+	}
+	//the calling thread takes the first run itself
+	transform_slice(&slices[0]);
+	for (i = 1; i < threads; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	for (i = 0; i < threads; ++i) {
+		ok = ok && slices[i].ok;
+	}
+	free(workers);
+	free(slices);
+	return ok;
+}
+
+//Read a mono .wav goal on the calling thread, which also sets the process-wide SAMPLE_RATE, returns 0 on failure
+int evaluation_goal_from_file(EvaluationGoal* goal, char* path, double note_max_duration, double frequency_max) {
+	if (!evaluation_goal_open(goal, path, note_max_duration, frequency_max)) return 0;
+	if (!evaluation_goal_blocks(goal, path, 0, evaluation_goal_block_count(goal), 1)) {
+		evaluation_goal_free(goal);
+		return 0;
+	}
+	return 1;
+}
+
+//Use audio at SAMPLE_RATE as the goal, returns 0 on failure
+int evaluation_goal_from_audio(EvaluationGoal* goal, const Audio* audio, double note_max_duration, double frequency_max) {
+	memset(goal, 0, sizeof(EvaluationGoal));
+	double* fftw_in = fftw_malloc(sizeof(double) * blockSize);
+	fftw_complex* fftw_out = fftw_malloc(sizeof(fftw_complex) * blockSize);
+	if (!fftw_in || !fftw_out) {
+		printf("error: fftw_malloc failed for the goal\n");
+		fftw_free(fftw_in);
+		fftw_free(fftw_out);
+		return 0;
+	}
+	pthread_mutex_lock(&planner_lock);
+	fftw_plan plan = fftw_plan_dft_r2c_1d(blockSize, fftw_in, fftw_out, FFTW_ESTIMATE);
+	pthread_mutex_unlock(&planner_lock);
+	goal->size = PassAudioData(audio->samples, audio->count, &goal->spectrum, &fftw_in, &fftw_out, &plan);
+	pthread_mutex_lock(&planner_lock);
+	fftw_destroy_plan(plan);
+	pthread_mutex_unlock(&planner_lock);
+	fftw_free(fftw_in);
+	fftw_free(fftw_out);
+	if (goal->size == 0) return 0;
+	goal_ranges(goal, audio->count, note_max_duration, frequency_max);
+	return 1;
+}
+
+/*
+
+Switch a built goal to comparing with mode. For FITNESS_BANDS the bands
+are pooled from the spectrum once, and for FITNESS_SPARSE the bins that
+are neither near-silent nor above frequency_max are indexed, with the
+rest of each block summed. Either way the spectrum, which is several
+times their size, is released. Returns 0 on failure.
+
+*/
+int evaluation_goal_set_mode(EvaluationGoal* goal, FitnessMode mode) {
+	if (mode == goal->mode) return 1;
+	if (mode == FITNESS_BINS || !goal->spectrum) return 0;
+	double* bands = NULL;
+	SparseGoal sparse;
+	memset(&sparse, 0, sizeof(SparseGoal));
+	if (mode == FITNESS_BANDS) {
+		BandEdges(goal->edges);
+		goal->blocks = GoalBands(goal->spectrum, goal->size, goal->edges, &bands);
+		if (!bands) return 0;
+	}
+	else {
+		int maxbin = (int)ceil(goal->frequency_max * blockSize / goal->sample_rate);
+		if (!SparseGoalFromSpectrum(goal->spectrum, goal->size, SPARSE_THRESHOLD, maxbin, &sparse)) return 0;
+		goal->blocks = sparse.blocks;
+	}
+	int blocks = goal->blocks;
+	evaluation_goal_free(goal);
+	goal->bands = bands;
+	goal->sparse = sparse;
+	goal->blocks = blocks;
+	goal->mode = mode;
+	return 1;
+}
+
+int evaluation_parse_fitness(const char* name, FitnessMode* mode) {
+	if (strcmp(name, "bins") == 0) *mode = FITNESS_BINS;
+	else if (strcmp(name, "bands") == 0) *mode = FITNESS_BANDS;
+	else if (strcmp(name, "sparse") == 0) *mode = FITNESS_SPARSE;
+	else return 0;
+	return 1;
+}
+
+const char* evaluation_fitness_name(FitnessMode mode) {
+	if (mode == FITNESS_BANDS) return "bands";
+	if (mode == FITNESS_SPARSE) return "sparse";
+	return "bins";
+}
+
+void evaluation_goal_free(EvaluationGoal* goal) {
+	int i;
+	if (goal->values) {
+		free(goal->values);
+	}
+	else if (goal->spectrum) {
+		for (i = 0; i < goal->size; ++i) {
+			free(goal->spectrum[i]);
+		}
+	}
+	free(goal->spectrum);
+	free(goal->bands);
+	SparseGoalFree(&goal->sparse);
+	goal->spectrum = NULL;
+	goal->values = NULL;
+	goal->bands = NULL;
+	goal->size = 0;
+	goal->blocks = 0;
+}
+
+/*
+
+Set up a context for goal on the calling thread, which also touches its
+buffers first. samples is goal->samples long, or NULL to have the context
+allocate it, for callers that place the render buffer themselves. The
+plan is measured, so make contexts before timing anything. Scratch space
+is sized for the goal's fitness mode, so set the mode first. Returns 0
+on failure.
+
+*/
+int evaluation_initialize(EvaluationContext* context, const EvaluationGoal* goal, Sample* samples) {
+	unsigned int i;
+	memset(context, 0, sizeof(EvaluationContext));
+	context->goal = goal;
+	if (samples) {
+		context->audio.samples = samples;
+		context->audio.count = goal->samples;
+		for (i = 0; i < goal->samples; ++i) {
+			samples[i] = 0;
+		}
+	}
+	else {
+		context->audio = audio_initialize(goal->samples);
+		context->owns_audio = 1;
+	}
+	context->fftw_in = fftw_malloc(sizeof(double) * blockSize);
+	context->fftw_out = fftw_malloc(sizeof(fftw_complex) * blockSize);
+	if (goal->mode == FITNESS_BANDS) {
+		context->scratch = malloc(sizeof(double) * BandScratchSize(goal->samples));
+	}
+	else if (goal->mode == FITNESS_SPARSE) {
+		context->scratch = malloc(sizeof(double) * SparseScratchSize(goal->samples, &goal->sparse));
+	}
+	if (!context->audio.samples || !context->fftw_in || !context->fftw_out
+		|| (goal->mode != FITNESS_BINS && !context->scratch)) {
+		printf("error: could not allocate evaluation buffers\n");
+		return 0;
+	}
+	memset(context->fftw_in, 0, sizeof(double) * blockSize);
+	memset(context->fftw_out, 0, sizeof(fftw_complex) * blockSize);
+	pthread_mutex_lock(&planner_lock);
+	context->plan = fftw_plan_dft_r2c_1d(blockSize, context->fftw_in, context->fftw_out, FFTW_MEASURE);
+	pthread_mutex_unlock(&planner_lock);
+	if (!context->plan) {
+		printf("error: Could not create plan\n");
+		return 0;
+	}
+	return 1;
+}
+
+//Render a genome into the context's audio and return its spectral difference from the goal
+double evaluation_difference(EvaluationContext* context, const char* genes, int length) {
+	const EvaluationGoal* goal = context->goal;
+	double phase = metrics_start();
+	Track track = track_initialize_from_binary(genes, length,
+		goal->duration, goal->note_max_duration, goal->frequency_max);
+	metrics_stop(PHASE_DECODE, phase);
+	phase = metrics_start();
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	track_audio_preallocated(&track, &context->audio);
+	metrics_stage_end(STAGE_TRACK, &sample);
+	metrics_stop(PHASE_RENDER, phase);
+	track_free(&track);
+	if (goal->mode == FITNESS_SPARSE) {
+		return SparseComparison(context->audio.samples, context->audio.count, &goal->sparse,
+			context->scratch, &context->fftw_in, &context->fftw_out, &context->plan);
+	}
+	if (goal->mode == FITNESS_BANDS) {
+		return BandComparison(context->audio.samples, context->audio.count, goal->bands, goal->blocks, goal->edges,
+			context->scratch, &context->fftw_in, &context->fftw_out, &context->plan);
+	}
+	return AudioComparison(context->audio.samples, context->audio.count, goal->spectrum, goal->size,
+		&context->fftw_in, &context->fftw_out, &context->plan);
+}
+
+//Fitness of a genome, higher is better and an exact match is DBL_MAX
+double evaluation_fitness(EvaluationContext* context, const char* genes, int length) {
+	if (context->audio.count == 0) {
+		return 0;
+	}
+	double difference = evaluation_difference(context, genes, length);
+	metrics_count(1);
+	return (difference > 0) ? (1000000000.0 / difference) : DBL_MAX;
+}
+
+//Score count genomes into fitness, reusing the context's plan and buffers for all of them
+void evaluation_batch(EvaluationContext* context, const char* const* genomes, const int* lengths, int count, double* fitness) {
+	int i;
+	for (i = 0; i < count; ++i) {
+		fitness[i] = evaluation_fitness(context, genomes[i], lengths[i]);
+	}
+}
+
+void evaluation_free(EvaluationContext* context) {
+	if (context->owns_audio) audio_free(&context->audio);
+	fftw_free(context->fftw_in);
+	fftw_free(context->fftw_out);
+	free(context->scratch);
+	if (context->plan) {
+		pthread_mutex_lock(&planner_lock);
+		fftw_destroy_plan(context->plan);
+		pthread_mutex_unlock(&planner_lock);
+	}
+	memset(context, 0, sizeof(EvaluationContext));
+}
@@ -0,0 +1,69 @@
+#ifndef H_EVALUATION_H
+#define H_EVALUATION_H
+#include "comparison.h"
+#include "audio.h"
+
+/*
+
+Scoring genomes against a goal, for pgenalg or any other driver. A goal
+is only read once it is built, so contexts on any number of threads can
+share one. A context holds the render buffer, FFT buffers and plan that
+one thread at a time scores with. The audio library keeps one
+SAMPLE_RATE per process, so goals in use at the same time share a rate,
+and a driver switching goals sets SAMPLE_RATE back to the goal's rate.
+
+*/
+
+//How renders are compared with the goal
+typedef enum {
+	FITNESS_BINS, //every complex bin of every block
+	FITNESS_BANDS, //the log energy of BAND_COUNT log-spaced bands of every block
+	FITNESS_SPARSE //the goal's significant bins, and the energy of the rest in closed form
+} FitnessMode;
+
+//Bins quieter than this fraction of the goal's loudest bin are left out of a sparse goal's index
+#define SPARSE_THRESHOLD 1e-4
+
+//The spectrum every genome is compared with, and the ranges genomes decode into
+typedef struct {
+	FitnessMode mode;
+	double** spectrum; //FITNESS_BINS only
+	int size;
+	double* values; //one array behind spectrum when the goal was read in blocks, NULL otherwise
+	double* bands; //FITNESS_BANDS only, BAND_COUNT per block
+	int blocks;
+	int edges[BAND_COUNT + 1];
+	SparseGoal sparse; //FITNESS_SPARSE only
+	unsigned int samples; //length of the goal, and of every render
+	unsigned int sample_rate; //SAMPLE_RATE the goal was built at
+	double duration; //seconds, note start times are spread over this
+	double note_max_duration;
+	double frequency_max;
+} EvaluationGoal;
+
+//Scratch space and an FFT plan for scoring on one thread
+typedef struct {
+	const EvaluationGoal* goal;
+	Audio audio; //the last genome rendered
+	int owns_audio;
+	double* fftw_in;
+	fftw_complex* fftw_out;
+	fftw_plan plan;
+	double* scratch; //working space of the band and sparse comparisons, sized for the goal's mode
+} EvaluationContext;
+
+int evaluation_goal_from_file(EvaluationGoal* goal, char* path, double note_max_duration, double frequency_max);
+int evaluation_goal_open(EvaluationGoal* goal, char* path, double note_max_duration, double frequency_max);
+int evaluation_goal_block_count(const EvaluationGoal* goal);
+int evaluation_goal_blocks(EvaluationGoal* goal, char* path, int first, int count, int threads);
+int evaluation_goal_from_audio(EvaluationGoal* goal, const Audio* audio, double note_max_duration, double frequency_max);
+int evaluation_goal_set_mode(EvaluationGoal* goal, FitnessMode mode);
+int evaluation_parse_fitness(const char* name, FitnessMode* mode);
+const char* evaluation_fitness_name(FitnessMode mode);
+void evaluation_goal_free(EvaluationGoal* goal);
+int evaluation_initialize(EvaluationContext* context, const EvaluationGoal* goal, Sample* samples);
+double evaluation_difference(EvaluationContext* context, const char* genes, int length);
+double evaluation_fitness(EvaluationContext* context, const char* genes, int length);
+void evaluation_batch(EvaluationContext* context, const char* const* genomes, const int* lengths, int count, double* fitness);
+void evaluation_free(EvaluationContext* context);
+#endif
@@ -0,0 +1,115 @@
+/// genetic.c
+//Random numbers and the genetic operators, kept apart from MPI so the benchmarks can use them
+#include <stdio.h>
+#include <string.h>
+#include "pgenalg.h"
+#include "metrics.h"
+
+double mutation_rate = 0.05;//mutation rate
+double crossover_rate = 0.97;//crossover rate
+
+//thread-safe rng stuff, each worker thread points rng_state at its own buffer
+struct drand48_data drand_buf;
+__thread struct drand48_data* rng_state = NULL;
+
+double randv(){
+	//return random value, assumes seed has been called
+	double value;
+	drand48_r(rng_state ? rng_state : &drand_buf, &value);
+	return value;
+}
+
+//steady-state workers read the rates while the main thread adapts them, so they go through relaxed atomics
+double rate_get(const double* rate){
+	double value;
+	__atomic_load(rate, &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+void rate_set(double* rate, double value){
+	__atomic_store(rate, &value, __ATOMIC_RELAXED);
+}
+
+unsigned int randr(unsigned int min, unsigned int max){
+	//rand value in range
+	return (max - min +1)*randv() + min;
+}
+
+void copy_chromosome(chromosome* out, const chromosome* in){
+	//copy only the genes in use, the rest of a slot is never read
+	out->fitness = in->fitness;
+	out->length = in->length;
+	memcpy(out->genes, in->genes, in->length);
+}
+
+void one_point_crossover(chromosome ch1, chromosome ch2, chromosome* out){
+        //Perform one point crossover between two chromosomes
+		MetricsSample sample;
+		metrics_stage_begin(&sample);
+		double r = randv();
+		//need to round to nearest note to prevent offset problem
+		
+        int r1 = ((int)(ch1.length * r / NOTE_BYTES)) * NOTE_BYTES;
+        int r2 = ((int)(ch2.length * r / NOTE_BYTES)) * NOTE_BYTES;
+		
+		//slice ch1 and ch2 and swap the partitions
+		int nlen1 = (r1 + ch2.length - r2);
+		int nlen2 = (r2 + ch1.length - r1);
+		chromosome newch1, newch2;
+		memcpy(newch1.genes, ch1.genes, ch1.length);//copy ch1 to newch1
+		memcpy(newch2.genes, ch2.genes, ch2.length);//copy ch2 to newch2
+		memcpy(newch1.genes + r1, ch2.genes + r2, ch2.length - r2);//copy right chunk of ch2 to right chunk of newch1
+		memcpy(newch2.genes + r2, ch1.genes + r1, ch1.length - r1);//copy right chunk of ch1 to right chunk of newch2
+		newch1.length = nlen1;
+		newch2.length = nlen2;
+		out[0] = newch1;
+		out[1] = newch2;
+		metrics_stage_end(STAGE_CROSSOVER, &sample);
+}
+
+void mutate(chromosome* chromo){
+	//mutate a chromosome in place
+
+	int i,j;
+	double rate = rate_get(&mutation_rate);
+	MetricsSample sample;
+	metrics_stage_begin(&sample);
+	for(i=0; i<chromo->length;i+=NOTE_BYTES){
+		switch(randr(0,2)){
+			case 0://insertion
+				if(randv() < rate){//randomly mutate based on mutation rate
+					if(chromo->length + NOTE_BYTES < MAX_GENES ){//only insert if room left in memory
+						memmove(chromo->genes + i + NOTE_BYTES, chromo->genes + i, chromo->length-i);
+						for(j=0;j<NOTE_BYTES;j++){
+							chromo->genes[i+j] = (char)randr(0,255);//RAND_CHAR;
+						}
+						chromo->length += NOTE_BYTES;
+					}
+				}
+				break;
+				
+			case 1://deletion
+				if(chromo->length != NOTE_BYTES){
+					if(randv() < rate){//randomly mutate based on mutation rate
+						if(chromo->length >= NOTE_BYTES + i ){//only insert if room left in memory
+							memmove(chromo->genes + i,chromo->genes + i + NOTE_BYTES,chromo->length-i-NOTE_BYTES);
+							chromo->length -= NOTE_BYTES;
+						}
+					}
+				}
+				break;
+				
+			case 2://substitution
+				for(j=0;j<NOTE_BYTES;j++){
+					if(randv() < rate){//randomly mutate based on mutation rate
+						chromo->genes[i+j] = (char)randr(0,255);//RAND_CHAR;
+					}
+				}
+				break;
+			
+			default:
+				printf("should not happen...\n");
+		}
+	}
+	metrics_stage_end(STAGE_MUTATE, &sample);
+}
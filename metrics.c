@@ -0,0 +1,215 @@
+/// metrics.c
+//Per-phase timings and resource use, gathered to rank 0 each generation
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <mpi.h>
+#include "metrics.h"
+#include "trace.h"
+
+const char* metrics_phase_names[PHASE_COUNT] = {
+	"decode", "render", "fft", "compare", "selection", "breed", "migration", "output"
+};
+
+const char* metrics_stage_names[STAGE_COUNT] = {
+	"note", "track", "fft", "compare", "mutate", "crossover"
+};
+
+//Counters of the calling thread, NULL when metrics are off
+static __thread ThreadMetrics* current = NULL;
+
+//Hardware counters of the calling thread, fds[0] < 0 when not counting
+static __thread PerfGroup perf = {{-1, -1, -1, -1, -1}};
+
+//Ranks the records are gathered over
+static MPI_Comm metrics_comm;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+
+Open the output on rank 0 and set up counters for the threads and the
+main thread. With perf, hardware counters are only used if every rank
+can open them, so the records stay alike. Collective over comm.
+
+*/
+int metrics_initialize(Metrics* metrics, const char* path, int threads, int perf_stages, MPI_Comm comm) {
+	memset(metrics, 0, sizeof(Metrics));
+	metrics_comm = comm;
+	MPI_Comm_rank(comm, &metrics->rank);
+	MPI_Comm_size(comm, &metrics->ranks);
+	metrics->threads = threads;
+	if (perf_stages) {
+		int opened = perf_open(&perf);
+		MPI_Allreduce(&opened, &metrics->perf, 1, MPI_INT, MPI_MIN, comm);
+		if (!metrics->perf) {
+			perf_close(&perf);
+			if (metrics->rank == 0) printf("warning: hardware counters unavailable, --perf ignored\n");
+		}
+	}
+	metrics->counters = calloc(threads + 1, sizeof(ThreadMetrics));
+	metrics->last = calloc(threads + 1, sizeof(ThreadMetrics));
+	metrics->gathered = calloc((size_t)(threads + 1) * metrics->ranks, sizeof(ThreadMetrics));
+	if (!metrics->counters || !metrics->last || !metrics->gathered) {
+		printf("error: could not allocate metrics\n");
+		return 0;
+	}
+	if (metrics->rank == 0) {
+		metrics->out = fopen(path, "w");
+		if (!metrics->out) {
+			printf("error: could not open metrics file %s\n", path);
+			return 0;
+		}
+	}
+	metrics->last_time = now();
+	current = &metrics->counters[threads];
+	return 1;
+}
+
+//Point the calling thread at its counters, thread == threads for the main thread
+void metrics_thread(Metrics* metrics, int thread) {
+	current = metrics->counters ? &metrics->counters[thread] : NULL;
+	if (current && metrics->perf && perf.fds[0] < 0) perf_open(&perf);
+}
+
+//Release the calling thread's hardware counters before it exits
+void metrics_thread_end() {
+	perf_close(&perf);
+}
+
+//Start timing a phase, returns 0 without reading the clock when metrics and tracing are off
+double metrics_start() {
+	return (current || trace_active()) ? now() : 0;
+}
+
+//Add a phase to the thread's counters and its trace
+void metrics_stop(MetricsPhase phase, double start) {
+	if (current) current->seconds[phase] += now() - start;
+	trace_span(metrics_phase_names[phase], start);
+}
+
+void metrics_count(long long evaluations) {
+	if (current) current->evaluations += evaluations;
+}
+
+//Read the hardware counters at the start of a stage, nothing without --perf
+void metrics_stage_begin(MetricsSample* sample) {
+	sample->valid = (perf.fds[0] >= 0) && perf_read(&perf, sample->values);
+}
+
+void metrics_stage_end(MetricsStage stage, const MetricsSample* sample) {
+	unsigned long long values[PERF_EVENTS];
+	int i;
+	if (!sample->valid || !current || !perf_read(&perf, values)) return;
+	for (i = 0; i < PERF_EVENTS; ++i) {
+		current->counters[stage][i] += values[i] - sample->values[i];
+	}
+	current->calls[stage]++;
+}
+
+static void write_thread(FILE* out, int generation, int rank, int thread, const ThreadMetrics* counters, int perf_stages) {
+	int i, j;
+	fprintf(out, "{\"type\":\"thread\",\"generation\":%d,\"rank\":%d,\"thread\":%d", generation, rank, thread);
+	for (i = 0; i < PHASE_COUNT; ++i) {
+		fprintf(out, ",\"%s\":%.9f", metrics_phase_names[i], counters->seconds[i]);
+	}
+	fprintf(out, ",\"evaluations\":%lld", counters->evaluations);
+	if (perf_stages) {
+		//clock rate in GHz is cycles over task clock nanoseconds
+		fprintf(out, ",\"stages\":{");
+		for (i = 0; i < STAGE_COUNT; ++i) {
+			const unsigned long long* values = counters->counters[i];
+			fprintf(out, "%s\"%s\":{\"calls\":%llu", (i > 0) ? "," : "", metrics_stage_names[i], counters->calls[i]);
+			for (j = 0; j < PERF_EVENTS; ++j) {
+				fprintf(out, ",\"%s\":%llu", perf_event_names[j], values[j]);
+			}
+			fprintf(out, ",\"ghz\":%.3f}", values[4] ? (double)values[0] / values[4] : 0.0);
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "}\n");
+}
+
+/*
+
+Write this generation's records: one per thread, with the main thread
+as thread -1, and one per rank with its wall time, evaluation rate, bytes
+migrated and peak resident size. With all_ranks every rank must call
+this, otherwise rank 0 records only itself.
+
+*/
+void metrics_record(Metrics* metrics, int generation, unsigned long bytes_migrated, int all_ranks) {
+	int i, r;
+	int slots = metrics->threads + 1;
+	ThreadMetrics* delta = malloc(slots * sizeof(ThreadMetrics));
+	double rank_values[4];
+	double* all_values = NULL;
+	long long evaluations = 0;
+	double time = now();
+	struct rusage usage;
+
+	for (i = 0; i < slots; ++i) {
+		ThreadMetrics counters = metrics->counters[i];
+		int p, e;
+		for (p = 0; p < PHASE_COUNT; ++p) {
+			delta[i].seconds[p] = counters.seconds[p] - metrics->last[i].seconds[p];
+		}
+		for (p = 0; p < STAGE_COUNT; ++p) {
+			for (e = 0; e < PERF_EVENTS; ++e) {
+				delta[i].counters[p][e] = counters.counters[p][e] - metrics->last[i].counters[p][e];
+			}
+			delta[i].calls[p] = counters.calls[p] - metrics->last[i].calls[p];
+		}
+		delta[i].evaluations = counters.evaluations - metrics->last[i].evaluations;
+		evaluations += delta[i].evaluations;
+		metrics->last[i] = counters;
+	}
+	getrusage(RUSAGE_SELF, &usage);
+	rank_values[0] = time - metrics->last_time;
+	rank_values[1] = (double)evaluations;
+	rank_values[2] = (double)(bytes_migrated - metrics->last_bytes);
+	rank_values[3] = (double)usage.ru_maxrss;
+	metrics->last_time = time;
+	metrics->last_bytes = bytes_migrated;
+
+	int ranks = all_ranks ? metrics->ranks : 1;
+	if (metrics->rank == 0) all_values = malloc(4 * ranks * sizeof(double));
+	if (all_ranks) {
+		MPI_Gather(delta, slots * sizeof(ThreadMetrics), MPI_BYTE, metrics->gathered,
+			slots * sizeof(ThreadMetrics), MPI_BYTE, 0, metrics_comm);
+		MPI_Gather(rank_values, 4, MPI_DOUBLE, all_values, 4, MPI_DOUBLE, 0, metrics_comm);
+	} else if (metrics->rank == 0) {
+		memcpy(metrics->gathered, delta, slots * sizeof(ThreadMetrics));
+		memcpy(all_values, rank_values, 4 * sizeof(double));
+	}
+
+	if (metrics->rank == 0) {
+		for (r = 0; r < ranks; ++r) {
+			const double* values = all_values + 4 * r;
+			for (i = 0; i < slots; ++i) {
+				write_thread(metrics->out, generation, r, (i == metrics->threads) ? -1 : i,
+					&metrics->gathered[r * slots + i], metrics->perf);
+			}
+			fprintf(metrics->out, "{\"type\":\"rank\",\"generation\":%d,\"rank\":%d,\"wall\":%.9f,\"evaluations\":%.0f,"
+				"\"evals_per_sec\":%.3f,\"bytes_migrated\":%.0f,\"peak_rss_kb\":%.0f}\n",
+				generation, r, values[0], values[1], (values[0] > 0) ? values[1] / values[0] : 0.0, values[2], values[3]);
+		}
+		fflush(metrics->out);
+	}
+	free(all_values);
+	free(delta);
+}
+
+void metrics_free(Metrics* metrics) {
+	if (metrics->out) fclose(metrics->out);
+	free(metrics->counters);
+	free(metrics->last);
+	free(metrics->gathered);
+	perf_close(&perf);
+	current = NULL;
+}
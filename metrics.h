@@ -0,0 +1,80 @@
+#ifndef H_METRICS_H
+#define H_METRICS_H
+#include <stdio.h>
+#include "perf.h"
+
+//Where the time goes, each thread adds to its own counters
+typedef enum {
+	PHASE_DECODE, //genes to notes
+	PHASE_RENDER, //notes to samples
+	PHASE_FFT,
+	PHASE_COMPARE, //spectrum difference
+	PHASE_SELECTION, //selection tables and parent draws
+	PHASE_BREED, //crossover and mutation
+	PHASE_MIGRATION, //waiting on migration messages
+	PHASE_OUTPUT, //best exchange, printing and snapshots
+	PHASE_COUNT
+} MetricsPhase;
+
+//Hot functions measured with hardware counters under --perf
+typedef enum {
+	STAGE_NOTE, //note_audio_preallocated
+	STAGE_TRACK, //track_audio_preallocated
+	STAGE_FFT, //PassAudioData
+	STAGE_COMPARE, //GetFitnessHelper
+	STAGE_MUTATE,
+	STAGE_CROSSOVER,
+	STAGE_COUNT
+} MetricsStage;
+
+typedef struct {
+	double seconds[PHASE_COUNT];
+	long long evaluations;
+	unsigned long long counters[STAGE_COUNT][PERF_EVENTS];
+	unsigned long long calls[STAGE_COUNT];
+} ThreadMetrics;
+
+//Counter values at the start of a stage
+typedef struct {
+	unsigned long long values[PERF_EVENTS];
+	int valid;
+} MetricsSample;
+
+/*
+
+Per-generation metrics written as JSON Lines by rank 0. Counters only
+ever grow, and each record is the difference from the last one, so
+threads never need to be stopped to reset them. Steady-state threads are
+read while they run, so their records may be off by an evaluation.
+
+*/
+typedef struct {
+	int rank;
+	int ranks;
+	int threads; //worker threads, the main thread's counters follow theirs
+	int perf; //hardware counters per stage
+	ThreadMetrics* counters;
+	ThreadMetrics* last;
+	ThreadMetrics* gathered;
+	double last_time;
+	unsigned long last_bytes;
+	FILE* out;
+} Metrics;
+
+extern const char* metrics_phase_names[PHASE_COUNT];
+extern const char* metrics_stage_names[STAGE_COUNT];
+
+//Only seen by files that include mpi.h first, the hooks below need no MPI
+#ifdef MPI_VERSION
+int metrics_initialize(Metrics* metrics, const char* path, int threads, int perf, MPI_Comm comm);
+#endif
+void metrics_thread(Metrics* metrics, int thread);
+void metrics_thread_end();
+double metrics_start();
+void metrics_stop(MetricsPhase phase, double start);
+void metrics_count(long long evaluations);
+void metrics_stage_begin(MetricsSample* sample);
+void metrics_stage_end(MetricsStage stage, const MetricsSample* sample);
+void metrics_record(Metrics* metrics, int generation, unsigned long bytes_migrated, int all_ranks);
+void metrics_free(Metrics* metrics);
+#endif
@@ -0,0 +1,284 @@
+/// migration.c
+//Exchange of packed, variable length chromosome batches between ranks
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "migration.h"
+
+int migration_parse_topology(const char* name, MigrationTopology* topology) {
+	if (strcmp(name, "ring") == 0) *topology = TOPOLOGY_RING;
+	else if (strcmp(name, "hypercube") == 0) *topology = TOPOLOGY_HYPERCUBE;
+	else if (strcmp(name, "random") == 0) *topology = TOPOLOGY_RANDOM;
+	else if (strcmp(name, "all") == 0) *topology = TOPOLOGY_ALL;
+	else return 0;
+	return 1;
+}
+
+const char* migration_topology_name(MigrationTopology topology) {
+	if (topology == TOPOLOGY_RING) return "ring";
+	if (topology == TOPOLOGY_HYPERCUBE) return "hypercube";
+	if (topology == TOPOLOGY_RANDOM) return "random";
+	return "all";
+}
+
+//Largest message a single neighbor can send us
+static int batch_max_bytes(const MigrationConfig* config) {
+	return sizeof(int) + config->batch_size * (PACKED_HEADER + MAX_GENES);
+}
+
+int migration_initialize(Migration* migration, const MigrationConfig* config, MPI_Comm comm) {
+	int i, j;
+	memset(migration, 0, sizeof(Migration));
+	migration->config = *config;
+	if (migration->config.batch_size < 1) migration->config.batch_size = 1;
+	if (migration->config.interval < 1) migration->config.interval = 1;
+	if (migration->config.neighbors < 1) migration->config.neighbors = 1;
+	if (migration->config.lag < 0) migration->config.lag = 0;
+	MPI_Comm_rank(comm, &migration->rank);
+	MPI_Comm_size(comm, &migration->size);
+
+	int peers = (migration->size > 1) ? (migration->size - 1) : 1;
+	migration->nslots = migration->config.lag + 1;
+	migration->slots = calloc(migration->nslots, sizeof(MigrationSlot));
+	if (!migration->slots) {
+		printf("error: could not allocate migration buffers\n");
+		return 0;
+	}
+	for (j = 0; j < migration->nslots; ++j) {
+		MigrationSlot* slot = &migration->slots[j];
+		slot->sendto = malloc(peers * sizeof(int));
+		slot->recvfrom = malloc(peers * sizeof(int));
+		slot->sendbuf = calloc(peers, sizeof(char*));
+		slot->recvbuf = calloc(peers, sizeof(char*));
+		slot->requests = malloc(2 * peers * sizeof(MPI_Request));
+		slot->statuses = malloc(2 * peers * sizeof(MPI_Status));
+		if (!slot->sendto || !slot->recvfrom || !slot->sendbuf
+			|| !slot->recvbuf || !slot->requests || !slot->statuses) {
+			printf("error: could not allocate migration buffers\n");
+			return 0;
+		}
+		for (i = 0; i < peers; ++i) {
+			slot->sendbuf[i] = malloc(batch_max_bytes(&migration->config));
+			slot->recvbuf[i] = malloc(batch_max_bytes(&migration->config));
+			if (!slot->sendbuf[i] || !slot->recvbuf[i]) {
+				printf("error: could not allocate migration buffers\n");
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void migration_free(Migration* migration) {
+	int i, j;
+	int peers = (migration->size > 1) ? (migration->size - 1) : 1;
+	if (!migration->slots) return;
+	for (j = 0; j < migration->nslots; ++j) {
+		MigrationSlot* slot = &migration->slots[j];
+		for (i = 0; i < peers; ++i) {
+			if (slot->sendbuf) free(slot->sendbuf[i]);
+			if (slot->recvbuf) free(slot->recvbuf[i]);
+		}
+		free(slot->sendto);
+		free(slot->recvfrom);
+		free(slot->sendbuf);
+		free(slot->recvbuf);
+		free(slot->requests);
+		free(slot->statuses);
+	}
+	free(migration->slots);
+}
+
+//Out-neighbors of rank <from> in the random topology for this epoch
+//Every rank runs the same generator so the in-neighbors can be derived locally
+static int random_targets(const MigrationConfig* config, int size, int epoch, int from, int* out) {
+	unsigned short xsubi[3];
+	xsubi[0] = (unsigned short)(config->seed ^ 0x330E);
+	xsubi[1] = (unsigned short)(epoch * 7919 + from);
+	xsubi[2] = (unsigned short)((from * 104729) ^ (config->seed >> 16));
+	int count = config->neighbors;
+	if (count > size - 1) count = size - 1;
+	int i, j;
+	for (i = 0; i < count; ++i) {
+		int target, taken;
+		do {
+			//pick among the size-1 other ranks
+			target = (int)(erand48(xsubi) * (size - 1));
+			if (target >= from) target += 1;
+			taken = 0;
+			for (j = 0; j < i; ++j) {
+				if (out[j] == target) taken = 1;
+			}
+		} while (taken);
+		out[i] = target;
+	}
+	return count;
+}
+
+//Work out who we send to and receive from this epoch, returns number of sends
+int migration_neighbors(Migration* migration, int epoch) {
+	const MigrationConfig* config = &migration->config;
+	MigrationSlot* slot = &migration->slots[epoch % migration->nslots];
+	int rank = migration->rank;
+	int size = migration->size;
+	int i, j;
+	slot->nsend = 0;
+	slot->nrecv = 0;
+	if (size < 2) return 0;
+
+	if (config->topology == TOPOLOGY_RING) {
+		slot->sendto[slot->nsend++] = (rank + 1) % size;
+		slot->recvfrom[slot->nrecv++] = (rank - 1 + size) % size;
+	} else if (config->topology == TOPOLOGY_HYPERCUBE) {
+		int dimensions = 0;
+		while ((1 << dimensions) < size) ++dimensions;
+		int partner = rank ^ (1 << (epoch % dimensions));
+		if (partner < size) {
+			slot->sendto[slot->nsend++] = partner;
+			slot->recvfrom[slot->nrecv++] = partner;
+		}
+	} else if (config->topology == TOPOLOGY_RANDOM) {
+		int* targets = malloc(size * sizeof(int));
+		slot->nsend = random_targets(config, size, epoch, rank, slot->sendto);
+		for (i = 0; i < size; ++i) {
+			if (i == rank) continue;
+			int count = random_targets(config, size, epoch, i, targets);
+			for (j = 0; j < count; ++j) {
+				if (targets[j] == rank) slot->recvfrom[slot->nrecv++] = i;
+			}
+		}
+		free(targets);
+	} else {
+		for (i = 0; i < size; ++i) {
+			if (i == rank) continue;
+			slot->sendto[slot->nsend++] = i;
+			slot->recvfrom[slot->nrecv++] = i;
+		}
+	}
+	return slot->nsend;
+}
+
+int chromosome_packed_size(const chromosome* chromo) {
+	return PACKED_HEADER + chromo->length;
+}
+
+//Pack chromosomes into a length-prefixed batch, returns bytes written
+long long chromosome_pack(chromosome* const* chromos, int count, char* buffer) {
+	char* position = buffer;
+	int i;
+	memcpy(position, &count, sizeof(int));
+	position += sizeof(int);
+	for (i = 0; i < count; ++i) {
+		const chromosome* chromo = chromos[i];
+		memcpy(position, &chromo->length, sizeof(int));
+		position += sizeof(int);
+		memcpy(position, &chromo->fitness, sizeof(double));
+		position += sizeof(double);
+		memcpy(position, chromo->genes, chromo->length);
+		position += chromo->length;
+	}
+	return position - buffer;
+}
+
+//Unpack a batch into out, returns number of chromosomes read
+int chromosome_unpack(const char* buffer, long long bytes, chromosome* out, int max) {
+	const char* position = buffer;
+	const char* end = buffer + bytes;
+	int count, i;
+	if (bytes < (long long)sizeof(int)) return 0;
+	memcpy(&count, position, sizeof(int));
+	position += sizeof(int);
+	if (count > max) count = max;
+	for (i = 0; i < count; ++i) {
+		chromosome* chromo = &out[i];
+		if (position + PACKED_HEADER > end) break;
+		memcpy(&chromo->length, position, sizeof(int));
+		position += sizeof(int);
+		memcpy(&chromo->fitness, position, sizeof(double));
+		position += sizeof(double);
+		if (chromo->length < 0 || chromo->length > MAX_GENES || position + chromo->length > end) {
+			printf("error: corrupt chromosome batch\n");
+			break;
+		}
+		memcpy(chromo->genes, position, chromo->length);
+		position += chromo->length;
+	}
+	return i;
+}
+
+/*
+
+Send batch_size emigrants to every out-neighbor of this epoch and post the
+receives for what the in-neighbors send us. emigrants holds nsend *
+batch_size pointers, grouped by neighbor, and is packed before returning so
+the population can change while the messages are in flight. All requests
+are posted at once so no rank waits on another's ordering.
+
+*/
+void migration_post(Migration* migration, int epoch, chromosome* const* emigrants, MPI_Comm comm) {
+	MigrationSlot* slot = &migration->slots[epoch % migration->nslots];
+	int batch = migration->config.batch_size;
+	int maxbytes = batch_max_bytes(&migration->config);
+	int tag = MIGRATION_TAG + (epoch % 1024);
+	int i;
+
+	slot->epoch = epoch;
+	slot->active = 1;
+	slot->done = 0;
+	slot->nrequests = 0;
+	for (i = 0; i < slot->nrecv; ++i) {
+		MPI_Irecv(slot->recvbuf[i], maxbytes, MPI_BYTE, slot->recvfrom[i],
+			tag, comm, &slot->requests[slot->nrequests++]);
+	}
+	for (i = 0; i < slot->nsend; ++i) {
+		int bytes = chromosome_pack(emigrants + i * batch, batch, slot->sendbuf[i]);
+		migration->bytes_sent += bytes;
+		MPI_Isend(slot->sendbuf[i], bytes, MPI_BYTE, slot->sendto[i],
+			tag, comm, &slot->requests[slot->nrequests++]);
+	}
+}
+
+//Give MPI a chance to move in-flight batches along without blocking
+void migration_progress(Migration* migration) {
+	int j, flag;
+	for (j = 0; j < migration->nslots; ++j) {
+		MigrationSlot* slot = &migration->slots[j];
+		if (slot->active && !slot->done) {
+			MPI_Testall(slot->nrequests, slot->requests, &flag, slot->statuses);
+			if (flag) slot->done = 1;
+		}
+	}
+}
+
+//Wait for an epoch to finish and unpack what arrived, returns number of immigrants
+//immigrants must have room for nrecv * batch_size entries
+int migration_complete(Migration* migration, int epoch, chromosome* immigrants) {
+	MigrationSlot* slot = &migration->slots[epoch % migration->nslots];
+	int batch = migration->config.batch_size;
+	int received = 0;
+	int i;
+	if (!slot->active || slot->epoch != epoch) return 0;
+	if (!slot->done) {
+		MPI_Waitall(slot->nrequests, slot->requests, slot->statuses);
+		slot->done = 1;
+	}
+	slot->active = 0;
+	if (!immigrants) return 0;
+
+	//receives were posted first, so their statuses lead the array
+	for (i = 0; i < slot->nrecv; ++i) {
+		int bytes;
+		MPI_Get_count(&slot->statuses[i], MPI_BYTE, &bytes);
+		received += chromosome_unpack(slot->recvbuf[i], bytes, immigrants + received, batch);
+	}
+	return received;
+}
+
+//Finish every epoch still in flight, discarding the immigrants
+void migration_drain(Migration* migration) {
+	int j;
+	for (j = 0; j < migration->nslots; ++j) {
+		MigrationSlot* slot = &migration->slots[j];
+		if (slot->active) migration_complete(migration, slot->epoch, NULL);
+	}
+}
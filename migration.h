@@ -0,0 +1,64 @@
+#ifndef H_MIGRATION_H
+#define H_MIGRATION_H
+#include <mpi.h>
+#include "pgenalg.h"
+
+//Which ranks exchange chromosomes with each other
+typedef enum {
+	TOPOLOGY_RING, //send to rank+1, receive from rank-1
+	TOPOLOGY_HYPERCUBE, //swap with the partner across one dimension per epoch
+	TOPOLOGY_RANDOM, //send to k random ranks, chosen the same way on every rank
+	TOPOLOGY_ALL //send to every other rank
+} MigrationTopology;
+
+typedef struct {
+	MigrationTopology topology;
+	int interval; //generations between migrations
+	int batch_size; //chromosomes sent to each neighbor
+	int neighbors; //out-degree of the random topology
+	int lag; //migration epochs a batch may stay in flight before it is merged
+	unsigned int seed; //shared by all ranks so they agree on the random graph
+} MigrationConfig;
+
+//One in-flight epoch, with send and receive buffers sized once for the worst case
+typedef struct {
+	int epoch;
+	int active; //posted and not yet merged
+	int done; //all requests have completed
+	int* sendto;
+	int* recvfrom;
+	int nsend;
+	int nrecv;
+	char** sendbuf;
+	char** recvbuf;
+	MPI_Request* requests;
+	MPI_Status* statuses;
+	int nrequests;
+} MigrationSlot;
+
+typedef struct {
+	MigrationConfig config;
+	int rank;
+	int size;
+	MigrationSlot* slots; //lag + 1 of them, indexed by epoch
+	int nslots;
+	unsigned long bytes_sent; //running total, for reporting
+} Migration;
+
+//Packed chromosome: int length, double fitness, then length bytes of genes
+#define PACKED_HEADER (sizeof(int) + sizeof(double))
+#define MIGRATION_TAG 4321
+
+int migration_parse_topology(const char* name, MigrationTopology* topology);
+const char* migration_topology_name(MigrationTopology topology);
+int migration_initialize(Migration* migration, const MigrationConfig* config, MPI_Comm comm);
+void migration_free(Migration* migration);
+int migration_neighbors(Migration* migration, int epoch);
+int chromosome_packed_size(const chromosome* chromo);
+long long chromosome_pack(chromosome* const* chromos, int count, char* buffer);
+int chromosome_unpack(const char* buffer, long long bytes, chromosome* out, int max);
+void migration_post(Migration* migration, int epoch, chromosome* const* emigrants, MPI_Comm comm);
+void migration_progress(Migration* migration);
+int migration_complete(Migration* migration, int epoch, chromosome* immigrants);
+void migration_drain(Migration* migration);
+#endif
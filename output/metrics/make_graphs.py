@@ -1,4 +1,5 @@
 import glob
+import json
 import matplotlib.pyplot as plt
 import numpy as np
 
@@ -79,4 +80,43 @@ for i, dataset in enumerate(datasets) :
 
 	print("total pop size " + str(dataset[0].pop_total) + " has color " + colors[i])
 
+#per-phase metrics written with --metrics, one JSON object per line
+phases = ['decode','render','fft','compare','selection','breed','migration','output']
+phase_colors = ['r','y','b','g','k','m','c','0.5']
+for n, filename in enumerate(glob.glob('*.jsonl')):
+	threads = {}
+	with open(filename, 'r') as f:
+		for line in f:
+			record = json.loads(line)
+			if record['type'] == 'thread':
+				threads.setdefault(record['generation'], []).append(record)
+	generations = sorted(threads)
+
+	#graph3: generation on x, time in each phase summed over every thread on y.
+	plt.figure(3 + 2*n)
+	plt.title(filename + " phases")
+	bottom = np.zeros(len(generations))
+	for k, phase in enumerate(phases):
+		values = np.asarray([sum(r[phase] for r in threads[g]) for g in generations])
+		plt.bar(generations, values, bottom=bottom, color=phase_colors[k], label=phase)
+		bottom += values
+	plt.legend()
+
+	#graph4: generation on x, busiest worker thread over the mean on y. 1 is perfectly balanced.
+	#generations with only the main thread's record, like a 1-thread run or a master rank, are left out
+	balanced = []
+	imbalance = []
+	for g in generations:
+		busy = [sum(r[phase] for phase in phases) for r in threads[g] if r['thread'] >= 0]
+		if not busy:
+			continue
+		mean = sum(busy) / len(busy)
+		balanced.append(g)
+		imbalance.append(max(busy) / mean if mean > 0 else 1.0)
+	plt.figure(4 + 2*n)
+	plt.title(filename + " imbalance")
+	plt.plot(balanced, imbalance, 'r')
+
+	print(filename + " has " + str(len(generations)) + " generations of metrics")
+
 plt.show()
\ No newline at end of file
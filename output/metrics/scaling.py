@@ -0,0 +1,134 @@
+#scaling benchmark driver: runs pgenalg over a matrix of ranks x threads x population sizes
+#and reports speedup, parallel efficiency and evaluations/sec per core.
+#
+#strong scaling keeps the total population fixed and splits it over the ranks,
+#weak scaling keeps the population per rank fixed so the total grows with the ranks.
+#
+#example, from the repository root:
+#	python output/metrics/scaling.py --goal song.wav --ranks 1,2,4 --threads 1,2 --population 256 --generations 10
+import argparse
+import csv
+import os
+import re
+import shlex
+import subprocess
+import tempfile
+
+parser = argparse.ArgumentParser(description="Strong and weak scaling runs of pgenalg")
+parser.add_argument("--goal", required=True, help="input .wav file")
+parser.add_argument("--binary", default="./pgenalg")
+parser.add_argument("--mpirun", default="mpirun --oversubscribe", help="launcher, -np N is appended")
+parser.add_argument("--ranks", default="1,2,4")
+parser.add_argument("--threads", default="1,2")
+parser.add_argument("--population", default="256", help="total for strong scaling, per rank for weak scaling")
+parser.add_argument("--generations", type=int, default=10)
+parser.add_argument("--repeats", type=int, default=3)
+parser.add_argument("--mode", choices=["strong", "weak", "both"], default="both")
+parser.add_argument("--out", default="scaling", help="directory for the table and plots")
+parser.add_argument("extra", nargs=argparse.REMAINDER, help="options passed on to pgenalg after --")
+args = parser.parse_args()
+
+def numbers(text):
+	return [int(x) for x in text.split(",") if x]
+
+def run(ranks, threads, population):
+	#run pgenalg once, returns (seconds, generations run)
+	directory = tempfile.mkdtemp(prefix="scaling_")
+	extra = [a for a in args.extra if a != "--"]
+	command = shlex.split(args.mpirun) + ["-np", str(ranks), args.binary, str(population), str(args.generations),
+		str(threads), "0", args.goal, directory] + extra
+	subprocess.check_call(command, stdout=subprocess.DEVNULL)
+	name = "output_%d_%d_%d_%d.txt" % (ranks, threads, population, args.generations)
+	values = {}
+	with open(os.path.join(directory, name), "r") as f:
+		for line in f:
+			match = re.match(r"\s*(\S+)\s+(.*\S)\s*$", line)
+			if match:
+				values[match.group(2)] = match.group(1)
+	for leftover in os.listdir(directory):
+		os.remove(os.path.join(directory, leftover))
+	os.rmdir(directory)
+	return float(values["TotalTime"]), int(values["Generations Run"])
+
+def median(values):
+	values = sorted(values)
+	middle = len(values) // 2
+	return values[middle] if len(values) % 2 else (values[middle - 1] + values[middle]) / 2.0
+
+modes = ["strong", "weak"] if args.mode == "both" else [args.mode]
+rows = []
+for mode in modes:
+	for population in numbers(args.population):
+		baseline = None
+		configs = sorted(((r, t) for r in numbers(args.ranks) for t in numbers(args.threads)), key=lambda c: (c[0] * c[1], c))
+		for ranks, threads in configs:
+			per_rank = population // ranks if mode == "strong" else population
+			if per_rank < threads:
+				print("skipping %s %d ranks x %d threads, too few chromosomes per thread" % (mode, ranks, threads))
+				continue
+			times = []
+			for repeat in range(args.repeats):
+				seconds, generations = run(ranks, threads, per_rank)
+				times.append(seconds)
+			time = median(times)
+			cores = ranks * threads
+			evaluations = float(per_rank) * ranks * generations
+			if baseline is None:
+				baseline = (time, cores)
+			#strong: speedup over the smallest run, weak: the smallest run's time over ours is the efficiency
+			if mode == "strong":
+				speedup = baseline[0] / time
+				efficiency = speedup * baseline[1] / cores
+			else:
+				efficiency = baseline[0] / time
+				speedup = efficiency * cores / baseline[1]
+			row = {"mode": mode, "population": population, "ranks": ranks, "threads": threads, "cores": cores,
+				"per_rank": per_rank, "time": time, "min_time": min(times), "max_time": max(times),
+				"speedup": speedup, "efficiency": efficiency, "evals_per_sec_per_core": evaluations / time / cores}
+			rows.append(row)
+			print("%-6s pop %-6d %2d ranks x %2d threads: %8.3fs  speedup %6.2f  efficiency %5.1f%%  %8.2f evals/s/core" % (
+				mode, population, ranks, threads, time, speedup, 100 * efficiency, row["evals_per_sec_per_core"]))
+
+if not os.path.isdir(args.out):
+	os.makedirs(args.out)
+fields = ["mode", "population", "ranks", "threads", "cores", "per_rank", "time", "min_time", "max_time",
+	"speedup", "efficiency", "evals_per_sec_per_core"]
+with open(os.path.join(args.out, "scaling.csv"), "w") as f:
+	writer = csv.DictWriter(f, fieldnames=fields)
+	writer.writeheader()
+	writer.writerows(rows)
+print("table written to " + os.path.join(args.out, "scaling.csv"))
+
+#plots are optional, the table is the result
+try:
+	import matplotlib
+	matplotlib.use("Agg")
+	import matplotlib.pyplot as plt
+except ImportError:
+	print("matplotlib not found, skipping plots")
+	raise SystemExit(0)
+
+colors = ['r','y','b','g','k','m','c']
+for mode in modes:
+	figure, axes = plt.subplots(1, 3, figsize=(15, 4))
+	series = sorted(set((r["population"], r["threads"]) for r in rows if r["mode"] == mode))
+	for i, (population, threads) in enumerate(series):
+		points = sorted((r for r in rows if r["mode"] == mode and r["population"] == population and r["threads"] == threads),
+			key=lambda r: r["cores"])
+		cores = [r["cores"] for r in points]
+		label = "pop %d, %d thread(s)" % (population, threads)
+		color = colors[i % len(colors)]
+		axes[0].plot(cores, [r["speedup"] for r in points], color + "o-", label=label)
+		axes[1].plot(cores, [r["efficiency"] for r in points], color + "o-", label=label)
+		axes[2].plot(cores, [r["evals_per_sec_per_core"] for r in points], color + "o-", label=label)
+	all_cores = sorted(set(r["cores"] for r in rows if r["mode"] == mode))
+	if all_cores:
+		axes[0].plot(all_cores, [c / float(all_cores[0]) for c in all_cores], "k--", label="ideal")
+	axes[0].set_title(mode + " scaling speedup")
+	axes[1].set_title(mode + " scaling efficiency")
+	axes[2].set_title("evaluations/sec per core")
+	for axis in axes:
+		axis.set_xlabel("cores (ranks x threads)")
+	axes[0].legend()
+	figure.savefig(os.path.join(args.out, mode + ".png"))
+	print("plot written to " + os.path.join(args.out, mode + ".png"))
@@ -0,0 +1,73 @@
+/// perf.c
+//Per-thread hardware counters through perf_event_open
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+
+const char* perf_event_names[PERF_EVENTS] = {
+	"cycles", "instructions", "cache_misses", "branch_misses", "task_clock_ns"
+};
+
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+} events[PERF_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK} //cycles over this gives the clock rate
+};
+
+/*
+
+Count user-space events of the calling thread on whatever cpu it runs.
+Returns 0 if any counter can't be opened, which is normal in VMs and
+containers or with a strict perf_event_paranoid.
+
+*/
+int perf_open(PerfGroup* group) {
+	int i;
+	for (i = 0; i < PERF_EVENTS; ++i) {
+		group->fds[i] = -1;
+	}
+	for (i = 0; i < PERF_EVENTS; ++i) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = (i == 0);
+		group->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : group->fds[0], 0);
+		if (group->fds[i] < 0) {
+			perf_close(group);
+			return 0;
+		}
+	}
+	ioctl(group->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(group->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return 1;
+}
+
+//Read every counter with one syscall, returns 0 on failure
+int perf_read(const PerfGroup* group, unsigned long long* values) {
+	unsigned long long buffer[PERF_EVENTS + 1]; //count, then the values
+	if (group->fds[0] < 0) return 0;
+	if (read(group->fds[0], buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer)) return 0;
+	memcpy(values, buffer + 1, PERF_EVENTS * sizeof(unsigned long long));
+	return 1;
+}
+
+void perf_close(PerfGroup* group) {
+	int i;
+	for (i = PERF_EVENTS - 1; i >= 0; --i) {
+		if (group->fds[i] >= 0) close(group->fds[i]);
+		group->fds[i] = -1;
+	}
+}
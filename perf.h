@@ -0,0 +1,17 @@
+#ifndef H_PERF_H
+#define H_PERF_H
+
+//Hardware and software counters read together as one group
+#define PERF_EVENTS 5
+
+//Counters of the calling thread, fds[0] leads the group
+typedef struct {
+	int fds[PERF_EVENTS];
+} PerfGroup;
+
+extern const char* perf_event_names[PERF_EVENTS];
+
+int perf_open(PerfGroup* group);
+int perf_read(const PerfGroup* group, unsigned long long* values);
+void perf_close(PerfGroup* group);
+#endif
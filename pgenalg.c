@@ -13,269 +13,1440 @@
 #include<mpi.h>
 #include<pthread.h>
 #include<float.h>
+#include<limits.h>
+#include<math.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<signal.h>
+#include<sys/socket.h>
+#include<sys/un.h>
 #include <fftw3.h>
-#include "audio.c"
-#include "comparison.h"
-
-#define NOTE_BYTES 12
+#include "metrics.h"
+#include "audio.h"
+#include "checkpoint.h"
+#include "evaluation.h"
+#include "migration.h"
+#include "placement.h"
+#include "queue.h"
+#include "selection.h"
+#include "stats.h"
+#include "store.h"
+#include "trace.h"
 
 chromosome* population; 
 chromosome* new_population; //for switchover
+MPI_Comm job_comm;//the ranks running this job, MPI_COMM_WORLD unless a manifest split it
 int mpi_myrank;
 int mpi_commsize;
 int population_size;//population size
 int max_generations;//max generations to run for
 double max_fitness; //best fitness of current generation
 int threads_per_rank;//number of threads per rank
-double mutation_rate = 0.05;//mutation rate
-double crossover_rate = 0.97;//crossover rate
 
-unsigned int song_max_samples = 48000;
-double song_max_duration = 60;
 double note_max_duration = 0.1;
 double frequency_max = 25000;
 
-int blockSize2 = 512;
+//how the ranks share the work
+typedef enum {
+	MODE_ISLAND, //every rank evolves its own population and migrates
+	MODE_MASTER, //rank 0 evolves one population and farms evaluation out in batches, scoring some itself
+	MODE_STEADY //islands where threads breed and replace continuously, with no generation barrier
+} run_mode_t;
+run_mode_t run_mode;
+int eval_batch_size;//chromosomes per batch in master mode
+int eval_lookahead;//batches queued per worker in master mode
+
+#define EVAL_TAG 5001
+#define RESULT_TAG 5002
+#define STOP_TAG 5003
+
+//parent selection, tables rebuilt after every evaluation
+Selector selector;
+SelectionScheme selection_scheme;
+int tournament_size;
+
+//population statistics, each evaluate thread keeps its own and they are merged at the barrier
+PopulationStats* thread_stats;
+PopulationStats generation_stats;
+int global_stats;//reduce the statistics across ranks every generation
+
+//stopping rules, all off by default, agreed across ranks each generation
+int stall_generations;//stop after this many generations without improvement
+double target_difference;//stop once the best difference score is this low
+double time_limit;//stop after this many seconds of wall-clock time
+double min_improvement;//stop if the best improves by less than this fraction...
+int improvement_window;//...over this many generations
+double* best_history;//global best of the last improvement_window generations
+double best_so_far;
+int last_improvement;//generation the global best last went up
+
+//adaptive operator rates, steered by improvement and diversity
+int adaptive_rates;
+double base_mutation_rate;
+double base_crossover_rate;
+
+//sub-island mode, each thread breeds within its own slice of the population
+int subislands;
+int subisland_migrants;//chromosomes passed to the next thread each generation
+ChromosomeQueue* thread_queues;//thread I receives from thread I-1 through thread_queues[I]
+
+//per-phase metrics, written as JSON Lines when a path is given
+const char* metrics_path;
+Metrics metrics;
+int perf_stages;//hardware counters around the hot functions
+
+//timeline trace, written at exit when a path is given
+const char* trace_path;
+int trace_events;//spans kept per thread
+
+//where worker threads run and what backs the big arrays
+Placement placement;
 
-//thread-safe rng stuff
-struct drand48_data drand_buf;
-double dv;
+//out-of-core populations, mapped from a file when a path is given
+const char* store_path;
+PopulationStore store;
+int elite_cache_size;//fittest members kept in RAM for breeding
+EliteCache elites;
+
+//checkpoint and restart, off unless a path is given
+const char* checkpoint_path;
+int checkpoint_interval;//generations between checkpoints
+const char* resume_path;
+
+//migration settings, overridden by --options
+MigrationConfig migration_config;
+
+//reproducible runs, every rank and thread seeds from base_seed
+unsigned int base_seed;
+int deterministic;//refuse settings whose outcome depends on timing
+const char* golden_path;//record the best fitness of every generation here...
+const char* golden_check_path;//...or check it against an earlier recording
+double golden_tolerance;//relative difference allowed by the check
+FILE* golden_file;
+int golden_mismatch;//first generation that didn't match
+char* input_file;//goal wav file, or a synth: spec
+int failed_rank;//first rank the job's setup failed on, or -1
+
+//steady-state mode, one lock per population slot
+pthread_mutex_t* slot_locks;
+volatile long long steady_claimed;//evaluations handed out to workers
+volatile long long steady_evaluations;//evaluations finished
+long long steady_budget;//total evaluations to run
+volatile int steady_stop;
+
+//lets the threads of one run_threads call wait for each other
+pthread_barrier_t thread_barrier;
+
+//what the evaluate threads are working on, the population or a batch from the master
+chromosome* eval_population;
+int eval_count;
 
 //DFT data for input file
-double** file_dft_data;
-int file_dft_length;
+EvaluationGoal goal;//the input file's spectrum, shared by every thread
+FitnessMode fitness_mode;//compare every bin, or band energies
+unsigned int default_sample_rate;//SAMPLE_RATE before any goal changed it, synthetic goals are made at this
+
+//goals already built, kept across the jobs of a manifest so each input is only read once
+typedef struct {
+	char* input;
+	EvaluationGoal goal;
+} CachedGoal;
+CachedGoal* goal_cache;
+int goal_cache_count;
+int cache_goals;//keep goals in the cache rather than freeing them after their job
 
 typedef struct {
 	int threadid;
-	Audio audio;
-	double*	fftw_in;
-	fftw_complex* fftw_out;
-	fftw_plan plan;
+	EvaluationContext eval;
+	struct drand48_data rng;
 } t_data;
 
-double randv(){
-	//return random value, assumes seed has been called
-	drand48_r(&drand_buf, &dv);
-	return dv;
+//background writer for WAV snapshots, with its own render and FFT buffers
+typedef struct {
+	t_data buffers;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	chromosome pending;
+	int pending_generation;
+	int has_pending;
+	int quit;
+	const char* output_directory;
+} t_snapshot;
+int stream_snapshots;//serving, so each WAV snapshot also goes down stdout to the client
+
+//worker threads report back here so the main thread can poll MPI while waiting
+pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t threads_done = PTHREAD_COND_INITIALIZER;
+int threads_finished;
+void* (*thread_routine)(void*);
+
+
+
+void thread_range(int threadID, int count, int* start, int* size){
+	//split count items into threads_per_rank contiguous chunks, spreading the remainder
+	int chunk_size = count / threads_per_rank;
+	int remainder = count % threads_per_rank;
+	*start = threadID * chunk_size;
+	*start += (threadID < remainder) ? threadID : remainder;
+	if (threadID < remainder) chunk_size += 1;
+	*size = chunk_size;
+}
+
+void* allocate_thread_buffers(void* input){
+	//set up a thread's evaluation context on that thread, so it and the thread's population slice
+	//are first touched there and the pages come from the thread's own NUMA node
+	t_data* t_input = (t_data*)input;
+	int start, chunk_size;
+	placement_record(&placement, t_input->threadid);
+	Sample* samples = placement_alloc(&placement, goal.samples * sizeof(Sample));
+	memset(&t_input->eval, 0, sizeof(EvaluationContext));
+	if(samples && !evaluation_initialize(&t_input->eval, &goal, samples)){
+		evaluation_free(&t_input->eval);
+		placement_release(&placement, samples, goal.samples * sizeof(Sample));
+	}
+	//a store is left sparse, writing whole slots would fill in the file, and workers have no population
+	if(!store_path && population){
+		thread_range(t_input->threadid, population_size, &start, &chunk_size);
+		memset(&population[start], 0, chunk_size * sizeof(chromosome));
+		memset(&new_population[start], 0, chunk_size * sizeof(chromosome));
+	}
+	return 0;
 }
 
-unsigned int randr(unsigned int min, unsigned int max){
-	//rand value in range
-	return (max - min +1)*randv() + min;
+void merge_rank_order(int threadID){
+	//join the slices' rank orders pairwise, every thread waits for the round before
+	int round, rounds = selector_merge_rounds(&selector);
+	for(round=0; round<rounds; round++){
+		pthread_barrier_wait(&thread_barrier);
+		selector_merge(&selector, threadID, round);
+	}
 }
 
 void* evaluate(void* input) {
 	//evaluate the fitness of a chromosome
+	//Thread I is responsible for chromosomes (I*P/N to I*P/N + P/N) of eval_population.
+	t_data* t_input = (t_data *)input;
+	int start, chunk_size;
+	thread_range(t_input->threadid, eval_count, &start, &chunk_size);
+	int i;
+	
+	//when scoring our own population, fill in this slice's statistics and selection tables as we go
+	int own = (eval_population == population && eval_count == population_size);
+	PopulationStats* stats = &thread_stats[t_input->threadid];
+	stats_reset(stats);
+	
+	//scored a window at a time through the batch call
+	const char* genomes[STORE_WINDOW];
+	int lengths[STORE_WINDOW];
+	double fitness[STORE_WINDOW];
+	for(i=start; i < start + chunk_size; i+=STORE_WINDOW){
+		int j, window = start + chunk_size - i;
+		if(window > STORE_WINDOW) window = STORE_WINDOW;
+		if(store_path){
+			store_prefetch(&store, &eval_population[i], window);
+		}
+		for(j=0; j<window; j++){
+			genomes[j] = eval_population[i + j].genes;
+			lengths[j] = eval_population[i + j].length;
+		}
+		evaluation_batch(&t_input->eval, genomes, lengths, window, fitness);
+		for(j=0; j<window; j++){
+			eval_population[i + j].fitness = fitness[j];
+			if(own){
+				selector.fitness[i + j] = fitness[j];
+				stats_add(stats, fitness[j], population[i + j].length, i + j);
+			}
+		}
+	}
+	
+	if(own){
+		double phase = metrics_start();
+		selector_build_slice(&selector, t_input->threadid, start, chunk_size);
+		merge_rank_order(t_input->threadid);
+		metrics_stop(PHASE_SELECTION, phase);
+	}
+
+	return 0;
+}
+
+void* prepare_selection(void* input){
+	//build this thread's slice of the selection tables and statistics, for when evaluation happened elsewhere
+	t_data* t_input = (t_data*)input;
+	int start, chunk_size, i;
+	double phase = metrics_start();
+	thread_range(t_input->threadid, population_size, &start, &chunk_size);
+	PopulationStats* stats = &thread_stats[t_input->threadid];
+	stats_reset(stats);
+	for(i=start; i < start + chunk_size; i++){
+		selector.fitness[i] = population[i].fitness;
+		stats_add(stats, population[i].fitness, population[i].length, i);
+	}
+	selector_build_slice(&selector, t_input->threadid, start, chunk_size);
+	merge_rank_order(t_input->threadid);
+	metrics_stop(PHASE_SELECTION, phase);
+	return 0;
+}
+
+int select_parent(int threadID){
+	//index of a parent drawn from the whole population, or this thread's slice in sub-island mode
+	if(subislands && selector.slice_count[threadID] > 0){
+		return selector_draw_slice(&selector, threadID);
+	}
+	return selector_draw(&selector);
+}
+
+const chromosome* select_parent_chromosome(int threadID){
+	//a parent drawn by select_parent, taken from the elite cache when the population is out of core
+	double phase = metrics_start();
+	int index = select_parent(threadID);
+	metrics_stop(PHASE_SELECTION, phase);
+	return store_path ? elite_lookup(&elites, population, index) : &population[index];
+}
+
+void* breed(void* input){
+	//do crossover and mutation
 	//Thread I is responsible for chromosomes (I*P/N to I*P/N + P/N).
 	t_data t_input = *((t_data *)input);
 	int threadID = t_input.threadid;
-	double* fftw_in = t_input.fftw_in;
-	fftw_complex* fftw_out = t_input.fftw_out;
-	fftw_plan plan = t_input.plan;
+	int start, chunk_size;
+	thread_range(threadID, population_size, &start, &chunk_size);
+	int i;
+	
+	//in sub-island mode, migrants from the previous thread replace random members of the slice
+	if(subislands && chunk_size > 0){
+		chromosome migrant;
+		int arrived = 0;
+		while(queue_pop(&thread_queues[threadID], &migrant)){
+			chromosome* slot = random_chromosome_from_range(start, chunk_size);
+			copy_chromosome(slot, &migrant);
+			if(store_path) elite_forget(&elites, slot - population);
+			selector_update(&selector, slot - population, migrant.fitness);
+			arrived = 1;
+		}
+		//draws stay within the slice, so only its own tables need building again
+		if(arrived && selection_scheme != SELECT_TOURNAMENT){
+			selector_build_slice(&selector, threadID, start, chunk_size);
+		}
+	}
+	//otherwise a fast neighbour's migrants could arrive this generation or the next depending on timing
+	if(subislands && deterministic) pthread_barrier_wait(&thread_barrier);
+	
+	//children come in pairs, an odd chunk keeps only the first of the last pair
+	for(i=start + 1; i < start + chunk_size + 1; i+=2){
+		if(store_path && (i - 1 - start) % STORE_WINDOW == 0){
+			int window = start + chunk_size - (i - 1);
+			store_prefetch(&store, &new_population[i-1], (window < STORE_WINDOW) ? window : STORE_WINDOW);
+		}
+		chromosome ch1, ch2;
+		copy_chromosome(&ch1, select_parent_chromosome(threadID));
+		copy_chromosome(&ch2, select_parent_chromosome(threadID));
+		chromosome ret[2];//return buffer for new chromosomes
+		double phase = metrics_start();
+		
+		//do crossover
+		if(randv() < rate_get(&crossover_rate)){
+			one_point_crossover(ch1, ch2, ret);
+		}
+		else{
+			copy_chromosome(&ret[0], &ch1);
+			copy_chromosome(&ret[1], &ch2);
+		}
+		//do mutations
+		mutate(&ret[0]);
+		mutate(&ret[1]);
+		copy_chromosome(&new_population[i-1], &ret[0]);
+		if(i < start + chunk_size) copy_chromosome(&new_population[i], &ret[1]);
+		metrics_stop(PHASE_BREED, phase);
+	}
+	
+	//pass some of the slice on to the next thread, dropped if it hasn't caught up
+	if(subislands && chunk_size > 0 && threads_per_rank > 1){
+		for(i=0; i<subisland_migrants; i++){
+			queue_push(&thread_queues[(threadID + 1) % threads_per_rank], &population[select_parent(threadID)]);
+		}
+	}
+	
+	return 0;
+}
+
+
+
+chromosome* random_chromosome_from_range(int start, int count){
+	//return pointer to a random chromosome in population[start, start + count)
+	int random_index = start + (int)(randv() * count);
+	return population + random_index;
+}
+
+chromosome* random_chromosome_from_population(){
+	//return pointer to a random chromosome in the population
+	return random_chromosome_from_range(0, population_size);
+}
 
-	int chunk_size = population_size / threads_per_rank;
-	int remainder;
-	if(chunk_size == 0){
-		remainder = population_size;
+
+const char* option_value(const char* arg, const char* name){
+	//return the value of a --name=value argument, or NULL if it doesn't match
+	size_t length = strlen(name);
+	if(strncmp(arg, name, length) == 0 && arg[length] == '='){
+		return arg + length + 1;
 	}
-	else{
-		remainder = population_size % chunk_size;
+	return NULL;
+}
+
+int agree(int ok){
+	//whether a setup step worked on every rank of the job, so they all carry on or all give up together,
+	//noting the first rank it failed on
+	int mine = ok ? mpi_commsize : mpi_myrank, first;
+	MPI_Allreduce(&mine, &first, 1, MPI_INT, MPI_MIN, job_comm);
+	if(first < mpi_commsize && failed_rank < 0) failed_rank = first;
+	return first == mpi_commsize;
+}
+
+void default_options(){
+	//put every setting and piece of run state back to its default, so each job of a manifest starts alike
+	run_mode = MODE_ISLAND;
+	eval_batch_size = 4;
+	eval_lookahead = 2;
+	selection_scheme = SELECT_TOURNAMENT;
+	tournament_size = 8;
+	global_stats = 0;
+	stall_generations = 0;
+	target_difference = 0;
+	time_limit = 0;
+	min_improvement = 0;
+	improvement_window = 0;
+	best_so_far = -1;
+	last_improvement = 0;
+	adaptive_rates = 0;
+	subislands = 0;
+	subisland_migrants = 1;
+	metrics_path = NULL;
+	memset(&metrics, 0, sizeof(Metrics));
+	perf_stages = 0;
+	trace_path = NULL;
+	trace_events = 65536;
+	placement_free(&placement);
+	store_path = NULL;
+	elite_cache_size = 64;
+	checkpoint_path = NULL;
+	checkpoint_interval = 10;
+	resume_path = NULL;
+	MigrationConfig migration_defaults = {TOPOLOGY_ALL, 1, 1, 2, 0, 1202107158};
+	migration_config = migration_defaults;
+	base_seed = 1202107158;
+	deterministic = 0;
+	golden_path = NULL;
+	golden_check_path = NULL;
+	golden_tolerance = 0;
+	golden_file = NULL;
+	golden_mismatch = 0;
+	slot_locks = NULL;
+	fitness_mode = FITNESS_BINS;
+	failed_rank = -1;
+	population = NULL;
+	new_population = NULL;
+	thread_stats = NULL;
+	best_history = NULL;
+	thread_queues = NULL;
+	memset(&selector, 0, sizeof(Selector));
+}
+
+int parse_options(int argc, char* argv[], int first){
+	//read the optional --name=value arguments, returns 0 on a bad option
+	int i;
+	const char* value;
+	for(i=first; i<argc; i++){
+		if((value = option_value(argv[i], "--topology"))){
+			if(!migration_parse_topology(value, &migration_config.topology)) return 0;
+		}
+		else if((value = option_value(argv[i], "--migration-interval"))){
+			migration_config.interval = atoi(value);
+		}
+		else if((value = option_value(argv[i], "--migration-batch"))){
+			migration_config.batch_size = atoi(value);
+		}
+		else if((value = option_value(argv[i], "--migration-neighbors"))){
+			migration_config.neighbors = atoi(value);
+		}
+		else if((value = option_value(argv[i], "--migration-lag"))){
+			migration_config.lag = atoi(value);
+		}
+		else if((value = option_value(argv[i], "--selection"))){
+			if(!selection_parse_scheme(value, &selection_scheme)) return 0;
+		}
+		else if((value = option_value(argv[i], "--tournament-size"))){
+			tournament_size = atoi(value);
+			if(tournament_size < 1) tournament_size = 1;
+		}
+		else if((value = option_value(argv[i], "--stall"))){
+			stall_generations = atoi(value);
+		}
+		else if((value = option_value(argv[i], "--target"))){
+			target_difference = atof(value);
+		}
+		else if((value = option_value(argv[i], "--time-limit"))){
+			time_limit = atof(value);
+		}
+		else if((value = option_value(argv[i], "--min-improvement"))){
+			min_improvement = atof(value);
+		}
+		else if((value = option_value(argv[i], "--improvement-window"))){
+			improvement_window = atoi(value);
+		}
+		else if(strcmp(argv[i], "--adaptive") == 0){
+			adaptive_rates = 1;
+		}
+		else if(strcmp(argv[i], "--global-stats") == 0){
+			global_stats = 1;
+		}
+		else if(strcmp(argv[i], "--subislands") == 0){
+			subislands = 1;
+		}
+		else if((value = option_value(argv[i], "--subisland-migrants"))){
+			subisland_migrants = atoi(value);
+			if(subisland_migrants < 1) subisland_migrants = 1;
+		}
+		else if((value = option_value(argv[i], "--metrics"))){
+			metrics_path = value;
+		}
+		else if(strcmp(argv[i], "--perf") == 0){
+			perf_stages = 1;
+		}
+		else if((value = option_value(argv[i], "--trace"))){
+			trace_path = value;
+		}
+		else if((value = option_value(argv[i], "--trace-events"))){
+			trace_events = atoi(value);
+			if(trace_events < 1) trace_events = 1;
+		}
+		else if((value = option_value(argv[i], "--pin"))){
+			if(!placement_parse_policy(value, &placement)) return 0;
+		}
+		else if((value = option_value(argv[i], "--hugepages"))){
+			if(!placement_parse_hugepages(value, &placement.hugepages)) return 0;
+		}
+		else if((value = option_value(argv[i], "--store"))){
+			store_path = value;
+		}
+		else if((value = option_value(argv[i], "--elite-cache"))){
+			elite_cache_size = atoi(value);
+			if(elite_cache_size < 0) elite_cache_size = 0;
+		}
+		else if((value = option_value(argv[i], "--checkpoint"))){
+			checkpoint_path = value;
+		}
+		else if((value = option_value(argv[i], "--checkpoint-interval"))){
+			checkpoint_interval = atoi(value);
+			if(checkpoint_interval < 1) checkpoint_interval = 1;
+		}
+		else if((value = option_value(argv[i], "--resume"))){
+			resume_path = value;
+		}
+		else if((value = option_value(argv[i], "--seed"))){
+			base_seed = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if(strcmp(argv[i], "--deterministic") == 0){
+			deterministic = 1;
+		}
+		else if((value = option_value(argv[i], "--golden"))){
+			golden_path = value;
+			deterministic = 1;
+		}
+		else if((value = option_value(argv[i], "--golden-check"))){
+			golden_check_path = value;
+			deterministic = 1;
+		}
+		else if((value = option_value(argv[i], "--golden-tolerance"))){
+			golden_tolerance = atof(value);
+		}
+		else if((value = option_value(argv[i], "--fitness"))){
+			if(!evaluation_parse_fitness(value, &fitness_mode)) return 0;
+		}
+		else if((value = option_value(argv[i], "--mode"))){
+			if(strcmp(value, "island") == 0) run_mode = MODE_ISLAND;
+			else if(strcmp(value, "master") == 0) run_mode = MODE_MASTER;
+			else if(strcmp(value, "steady") == 0) run_mode = MODE_STEADY;
+			else return 0;
+		}
+		else if((value = option_value(argv[i], "--eval-batch"))){
+			eval_batch_size = atoi(value);
+			if(eval_batch_size < 1) eval_batch_size = 1;
+		}
+		else if((value = option_value(argv[i], "--lookahead"))){
+			eval_lookahead = atoi(value);
+			if(eval_lookahead < 1) eval_lookahead = 1;
+		}
+		else{
+			if(mpi_myrank == 0){
+				printf("error: Unrecognized option %s\n", argv[i]);
+			}
+			return 0;
+		}
 	}
-	int start = threadID * chunk_size;
-	start += (threadID < remainder) ? threadID : remainder;
-	if (threadID < remainder) chunk_size += 1;
+	return 1;
+}
+
+const char* routine_name(void* (*routine)(void*)){
+	//name of a thread routine in the trace
+	if(routine == evaluate) return "evaluate";
+	if(routine == breed) return "breed";
+	if(routine == prepare_selection) return "prepare selection";
+	if(routine == initialize_population) return "initialize";
+	if(routine == steady_worker) return "steady worker";
+	return "thread";
+}
+
+void* thread_start(void* input){
+	//run the current routine on this thread's rng and let the main thread know we are done
+	rng_state = &((t_data*)input)->rng;
+	metrics_thread(&metrics, ((t_data*)input)->threadid);
+	trace_thread(((t_data*)input)->threadid, NULL);
+	double span = trace_start();
+	thread_routine(input);
+	trace_span(routine_name(thread_routine), span);
+	metrics_thread_end();
+	pthread_mutex_lock(&threads_lock);
+	threads_finished++;
+	pthread_cond_signal(&threads_done);
+	pthread_mutex_unlock(&threads_lock);
+	return 0;
+}
+
+void start_threads(void* (*routine)(void*), pthread_t* threads, t_data* threadData){
+	//start routine on every thread without waiting for it
+	int i;
+	thread_routine = routine;
+	threads_finished = 0;
+	for (i = 0; i < threads_per_rank; i++) {
+		pthread_create(&threads[i], placement_attr(&placement, i), thread_start, &(threadData[i]));
+	}
+}
+
+int wait_threads(long nanoseconds){
+	//wait up to nanoseconds for every thread to finish the routine started on it, returns 1 once they have
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += nanoseconds;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&threads_lock);
+	if(threads_finished < threads_per_rank){
+		pthread_cond_timedwait(&threads_done, &threads_lock, &deadline);
+	}
+	int finished = (threads_finished == threads_per_rank);
+	pthread_mutex_unlock(&threads_lock);
+	return finished;
+}
+
+void join_threads(pthread_t* threads){
+	int i;
+	for (i = 0; i < threads_per_rank; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+void run_threads(void* (*routine)(void*), pthread_t* threads, t_data* threadData, Migration* migration){
+	//run routine on every thread, keeping in-flight migration moving until they all finish
+	start_threads(routine, threads, threadData);
+	while(!wait_threads(200000)){
+		migration_progress(migration);
+	}
+	join_threads(threads);
+}
+
+void copy_slot(chromosome* out, int slot){
+	//copy a population member, holding its lock in steady-state mode
+	if(slot_locks) pthread_mutex_lock(&slot_locks[slot]);
+	copy_chromosome(out, &population[slot]);
+	if(slot_locks) pthread_mutex_unlock(&slot_locks[slot]);
+}
+
+void store_slot(const chromosome* chromo, int slot){
+	//overwrite a population member, holding its lock in steady-state mode
+	if(slot_locks) pthread_mutex_lock(&slot_locks[slot]);
+	copy_chromosome(&population[slot], chromo);
+	if(store_path) elite_forget(&elites, slot);
+	if(slot_locks) pthread_mutex_unlock(&slot_locks[slot]);
+}
+
+int steady_tournament(int tournament_size, int best){
+	//index of the fittest (or least fit) of tournament_size random members
+	//fitness is read without the lock, a stale value only skews one tournament
+	int winner = random_chromosome_from_population() - population;
 	int i;
+	for(i=0; i<tournament_size; i++){
+		int index = random_chromosome_from_population() - population;
+		if((population[index].fitness > population[winner].fitness) == best){
+			winner = index;
+		}
+	}
+	return winner;
+}
+
+void steady_replace(const chromosome* child){
+	//replace the loser of a reverse tournament if the child beats it
+	int loser = steady_tournament(tournament_size, 0);
+	pthread_mutex_lock(&slot_locks[loser]);
+	if(child->fitness > population[loser].fitness){
+		copy_chromosome(&population[loser], child);
+		if(store_path) elite_forget(&elites, loser);
+	}
+	pthread_mutex_unlock(&slot_locks[loser]);
+}
+
+void* steady_worker(void* input){
+	/*
 	
-	for(i=start; i < start + chunk_size; i++){
-		chromosome chromo = population[i];
+	Steady-state mode. Each thread repeatedly picks two parents, breeds
+	and evaluates two children, and puts them back over weak members of
+	the shared population. Slots are locked one at a time only while
+	being copied, so threads never wait on each other's evaluations.
+	
+	*/
+	t_data* t_input = (t_data*)input;
+	chromosome parents[2];
+	chromosome ret[2];
+	
+	while(!steady_stop){
+		if(__sync_fetch_and_add(&steady_claimed, 2) >= steady_budget) break;
 		
-		/* DO ACTUAL EVALUATION HERE */
-		Track track = track_initialize_from_binary(chromo.genes, chromo.length,
-			song_max_duration, note_max_duration, frequency_max);
-		track_audio_preallocated(&track, &t_input.audio);
-
-		chromo.fitness = 0;
-		if (audio_duration(&t_input.audio) > 0) {
-			chromo.fitness = AudioComparison(t_input.audio.samples, t_input.audio.count, file_dft_data, file_dft_length, &fftw_in, &fftw_out, &plan);
-			if (chromo.fitness > 0) {
-				chromo.fitness = (1000000000.0 / chromo.fitness);
-			} else {
-				chromo.fitness = DBL_MAX;
-			}
+		double phase = metrics_start();
+		copy_slot(&parents[0], steady_tournament(tournament_size, 1));
+		copy_slot(&parents[1], steady_tournament(tournament_size, 1));
+		metrics_stop(PHASE_SELECTION, phase);
+		phase = metrics_start();
+		if(randv() < rate_get(&crossover_rate)){
+			one_point_crossover(parents[0], parents[1], ret);
+		}
+		else{
+			copy_chromosome(&ret[0], &parents[0]);
+			copy_chromosome(&ret[1], &parents[1]);
 		}
+		mutate(&ret[0]);
+		mutate(&ret[1]);
+		metrics_stop(PHASE_BREED, phase);
 		
-		track_free(&track);
+		ret[0].fitness = evaluation_fitness(&t_input->eval, ret[0].genes, ret[0].length);
+		ret[1].fitness = evaluation_fitness(&t_input->eval, ret[1].genes, ret[1].length);
+		steady_replace(&ret[0]);
+		steady_replace(&ret[1]);
+		__sync_fetch_and_add(&steady_evaluations, 2);
+	}
+	return 0;
+}
+
+void steady_wait(long long evaluations, Migration* migration){
+	//wait for the workers to reach a number of evaluations, moving migration along meanwhile
+	struct timespec pause = {0, 200000};
+	while(steady_evaluations < evaluations && steady_evaluations < steady_budget){
+		migration_progress(migration);
+		nanosleep(&pause, NULL);
+	}
+}
+
+void* initialize_population(void* input){
+	//fill this thread's slice with random chromosomes, so its pages are first touched here
+	t_data* t_input = (t_data*)input;
+	int start, chunk_size;
+	thread_range(t_input->threadid, population_size, &start, &chunk_size);
+	int i, j;
+	for(i=start; i<start + chunk_size; i++){
+		chromosome* tmp = &population[i];
+		tmp->fitness = 0;
+		tmp->length = randr(150,250)*NOTE_BYTES;//start chromosomes between with random size
+		for(j=0;j<tmp->length;j++){//assign random char values (0-255)
+			tmp->genes[j] = (char)randr(0,255);//RAND_CHAR;
+		}
+	}
+	return 0;
+}
+
+void stream_file(const char* path){
+	//send a saved file down stdout as a "wav <bytes> <path>" line and then its bytes, in one piece
+	FILE* in = fopen(path, "rb");
+	if(!in) return;
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	rewind(in);
+	char* data = malloc(size);
+	if(size >= 0 && data && fread(data, 1, size, in) == (size_t)size){
+		flockfile(stdout);
+		printf("wav %ld %s\n", size, path);
+		fwrite(data, 1, size, stdout);
+		fflush(stdout);
+		funlockfile(stdout);
+	}
+	free(data);
+	fclose(in);
+}
+
+void write_snapshot(t_snapshot* snapshot, chromosome* best_chromo, int generation){
+	//render, score and save one chromosome, then print its summary in one go
+	unsigned int i;
+	char report[1024];
+	int length = 0;
+	double similarity = evaluation_difference(&snapshot->buffers.eval, best_chromo->genes, best_chromo->length);
+	char fname[256];
+	sprintf(fname, "%s/audio_result_%d.wav", snapshot->output_directory, generation);
+	audio_save(&snapshot->buffers.eval.audio, fname);
+	Track track = track_initialize_from_binary(best_chromo->genes, best_chromo->length, goal.duration, goal.note_max_duration, goal.frequency_max);
+	double freqMax = DBL_MIN; double freqMin = DBL_MAX;
+	double volMax = DBL_MIN; double volMin = DBL_MAX;
+	double durMax = DBL_MIN; double durMin = DBL_MAX;
+	for (i = 0; i < track.count; ++i) {
+		Note* note = &track.notes[i];
+		if (note->frequency < freqMin) freqMin = note->frequency;
+		if (note->frequency > freqMax) freqMax = note->frequency;
+		if (note->volume < volMin) volMin = note->volume;
+		if (note->volume > volMax) volMax = note->volume;
+		if (note->duration < durMin) durMin = note->duration;
+		if (note->duration > durMax) durMax = note->duration;
+	}
+	length += snprintf(report + length, sizeof(report) - length, "Snapshot %s\n\tDifference Score: %.0f\n", fname, similarity);
+	length += snprintf(report + length, sizeof(report) - length, "\tNotes: %d (%d bytes)\n", track.count, best_chromo->length);
+	length += snprintf(report + length, sizeof(report) - length, "\tFrequency: %.0f - %.0f\n", freqMin, freqMax);
+	length += snprintf(report + length, sizeof(report) - length, "\tVolume: %.3f - %.3f\n", volMin, volMax);
+	length += snprintf(report + length, sizeof(report) - length, "\tDuration: %.3f - %.3f\n", durMin, durMax);
+	printf("%s", report);
+	fflush(stdout);
+	if(stream_snapshots){
+		stream_file(fname);
+	}
+	track_free(&track);
+}
+
+void* snapshot_thread(void* input){
+	//write snapshots as they are handed over until told to quit
+	t_snapshot* snapshot = (t_snapshot*)input;
+	chromosome* chromo = malloc(sizeof(chromosome));
+	trace_thread(threads_per_rank + 1, "writer");
+	pthread_mutex_lock(&snapshot->lock);
+	while(1){
+		while(!snapshot->has_pending && !snapshot->quit){
+			pthread_cond_wait(&snapshot->changed, &snapshot->lock);
+		}
+		if(!snapshot->has_pending) break;
+		*chromo = snapshot->pending;
+		int generation = snapshot->pending_generation;
+		pthread_mutex_unlock(&snapshot->lock);
 		
-		population[i] = chromo;
+		double span = trace_start();
+		write_snapshot(snapshot, chromo, generation);
+		trace_span("snapshot", span);
+		
+		pthread_mutex_lock(&snapshot->lock);
+		snapshot->has_pending = 0;
+		pthread_cond_broadcast(&snapshot->changed);
+	}
+	pthread_mutex_unlock(&snapshot->lock);
+	free(chromo);
+	return 0;
+}
+
+int snapshot_initialize(t_snapshot* snapshot, const char* output_directory){
+	//allocate the writer's buffers and start its thread
+	snapshot->output_directory = output_directory;
+	snapshot->has_pending = 0;
+	snapshot->quit = 0;
+	snapshot->buffers.threadid = -1;
+	if ( !evaluation_initialize(&snapshot->buffers.eval, &goal, NULL) ) {
+		printf("error: could not set up the snapshot writer\n");
+		evaluation_free(&snapshot->buffers.eval);
+		return 0;
+	}
+	pthread_mutex_init(&snapshot->lock, NULL);
+	pthread_cond_init(&snapshot->changed, NULL);
+	pthread_create(&snapshot->thread, NULL, snapshot_thread, snapshot);
+	return 1;
+}
+
+void snapshot_submit(t_snapshot* snapshot, const chromosome* chromo, int generation){
+	//hand a chromosome to the writer, waiting only if the previous one is still being written
+	pthread_mutex_lock(&snapshot->lock);
+	while(snapshot->has_pending){
+		pthread_cond_wait(&snapshot->changed, &snapshot->lock);
 	}
+	snapshot->pending = *chromo;
+	snapshot->pending_generation = generation;
+	snapshot->has_pending = 1;
+	pthread_cond_broadcast(&snapshot->changed);
+	pthread_mutex_unlock(&snapshot->lock);
+}
+
+void snapshot_free(t_snapshot* snapshot){
+	//finish any pending snapshot and stop the writer
+	pthread_mutex_lock(&snapshot->lock);
+	snapshot->quit = 1;
+	pthread_cond_broadcast(&snapshot->changed);
+	pthread_mutex_unlock(&snapshot->lock);
+	pthread_join(snapshot->thread, NULL);
+	pthread_mutex_destroy(&snapshot->lock);
+	pthread_cond_destroy(&snapshot->changed);
+	evaluation_free( &snapshot->buffers.eval );
+}
 
+int batch_max_bytes(){
+	//largest evaluation batch message: start id, then packed chromosomes
+	return sizeof(int) + sizeof(int) + eval_batch_size * (PACKED_HEADER + MAX_GENES);
+}
+
+int result_bytes(int count){
+	//result message: start id, count, then one fitness per chromosome
+	return 2 * sizeof(int) + count * sizeof(double);
+}
+
+void evaluation_worker(pthread_t* threads, t_data* threadData, Migration* migration){
+	/*
+	
+	Worker side of master mode. Batches arrive from rank 0 as a start id
+	followed by packed chromosomes, and the fitness values go back with the
+	same start id. The next receive is posted before evaluating so the
+	following batch transfers while this one runs.
+	
+	*/
+	int max_bytes = batch_max_bytes();
+	char* buffers[2];
+	buffers[0] = malloc(max_bytes);
+	buffers[1] = malloc(max_bytes);
+	char* results = malloc(result_bytes(eval_batch_size));
+	chromosome* batch = malloc(eval_batch_size * sizeof(chromosome));
+	MPI_Request request;
+	MPI_Status status;
+	int current = 0;
+	int i;
+	
+	MPI_Irecv(buffers[current], max_bytes, MPI_BYTE, 0, MPI_ANY_TAG, job_comm, &request);
+	while(1){
+		MPI_Wait(&request, &status);
+		if(status.MPI_TAG == STOP_TAG) break;
+		int bytes;
+		MPI_Get_count(&status, MPI_BYTE, &bytes);
+		MPI_Irecv(buffers[1 - current], max_bytes, MPI_BYTE, 0, MPI_ANY_TAG, job_comm, &request);
+		
+		int start;
+		memcpy(&start, buffers[current], sizeof(int));
+		int count = chromosome_unpack(buffers[current] + sizeof(int), bytes - sizeof(int), batch, eval_batch_size);
+		eval_population = batch;
+		eval_count = count;
+		run_threads(evaluate, threads, threadData, migration);
+		
+		char* position = results;
+		memcpy(position, &start, sizeof(int));
+		position += sizeof(int);
+		memcpy(position, &count, sizeof(int));
+		position += sizeof(int);
+		for(i=0; i<count; i++){
+			memcpy(position, &batch[i].fitness, sizeof(double));
+			position += sizeof(double);
+		}
+		MPI_Send(results, result_bytes(count), MPI_BYTE, 0, RESULT_TAG, job_comm);
+		current = 1 - current;
+	}
+	
+	free(buffers[0]);
+	free(buffers[1]);
+	free(results);
+	free(batch);
+}
+
+int send_batch(int worker, int start, char* buffer, MPI_Request* request, chromosome** batch){
+	//pack the chromosomes from start onwards and post them to a worker, returns how many
+	int i;
+	int count = (population_size - start < eval_batch_size) ? (population_size - start) : eval_batch_size;
+	for(i=0; i<count; i++){
+		batch[i] = &population[start + i];
+	}
+	memcpy(buffer, &start, sizeof(int));
+	int bytes = sizeof(int) + chromosome_pack(batch, count, buffer + sizeof(int));
+	MPI_Isend(buffer, bytes, MPI_BYTE, worker, EVAL_TAG, job_comm, request);
+	return count;
+}
+
+int dispatch_evaluation(pthread_t* threads, t_data* threadData){
+	/*
+	
+	Master side of master mode. Every worker starts with <lookahead>
+	batches queued, and gets another as soon as it returns one, so faster
+	nodes simply take more batches. Each worker handles its batches in
+	order, so its send buffers are reused round-robin. Meanwhile rank 0's
+	own threads score a batch each from what is left, polling for results
+	between waits. Returns how many the workers scored.
+	
+	*/
+	int workers = mpi_commsize - 1;
+	int slots = workers * eval_lookahead;
+	int max_bytes = batch_max_bytes();
+	char** buffers = malloc(slots * sizeof(char*));
+	MPI_Request* requests = malloc(slots * sizeof(MPI_Request));
+	int* sent = calloc(mpi_commsize, sizeof(int));
+	char* results = malloc(result_bytes(eval_batch_size));
+	chromosome** batch = malloc(eval_batch_size * sizeof(chromosome*));
+	MPI_Status status;
+	int next = 0, done = 0, local = 0, remote = 0;
+	int i, k;
+	for(i=0; i<slots; i++){
+		buffers[i] = malloc(max_bytes);
+		requests[i] = MPI_REQUEST_NULL;
+	}
+	
+	for(k=0; k<eval_lookahead; k++){
+		for(i=1; i<mpi_commsize && next < population_size; i++){
+			int slot = (i - 1) * eval_lookahead + (sent[i]++ % eval_lookahead);
+			next += send_batch(i, next, buffers[slot], &requests[slot], batch);
+		}
+	}
+	
+	while(done < population_size){
+		if(!local && next < population_size){
+			local = population_size - next;
+			if(local > eval_batch_size * threads_per_rank) local = eval_batch_size * threads_per_rank;
+			eval_population = &population[next];
+			eval_count = local;
+			next += local;
+			start_threads(evaluate, threads, threadData);
+		}
+		if(local){
+			int arrived;
+			MPI_Iprobe(MPI_ANY_SOURCE, RESULT_TAG, job_comm, &arrived, MPI_STATUS_IGNORE);
+			if(!arrived){
+				if(wait_threads(200000)){
+					join_threads(threads);
+					done += local;
+					local = 0;
+				}
+				continue;
+			}
+		}
+		MPI_Recv(results, result_bytes(eval_batch_size), MPI_BYTE, MPI_ANY_SOURCE, RESULT_TAG, job_comm, &status);
+		int start, count;
+		char* position = results;
+		memcpy(&start, position, sizeof(int));
+		position += sizeof(int);
+		memcpy(&count, position, sizeof(int));
+		position += sizeof(int);
+		for(i=0; i<count; i++){
+			memcpy(&population[start + i].fitness, position, sizeof(double));
+			position += sizeof(double);
+		}
+		done += count;
+		remote += count;
+		
+		int worker = status.MPI_SOURCE;
+		if(next < population_size){
+			int slot = (worker - 1) * eval_lookahead + (sent[worker]++ % eval_lookahead);
+			MPI_Wait(&requests[slot], MPI_STATUS_IGNORE);
+			next += send_batch(worker, next, buffers[slot], &requests[slot], batch);
+		}
+	}
+	
+	MPI_Waitall(slots, requests, MPI_STATUSES_IGNORE);
+	for(i=0; i<slots; i++){
+		free(buffers[i]);
+	}
+	free(buffers);
+	free(requests);
+	free(sent);
+	free(results);
+	free(batch);
+	return remote;
+}
+
+void stop_workers(){
+	//tell every worker in master mode there is nothing more to evaluate
+	int i;
+	for(i=1; i<mpi_commsize; i++){
+		MPI_Send(NULL, 0, MPI_BYTE, i, STOP_TAG, job_comm);
+	}
+}
+
+void gather_stats(){
+	//merge the per-thread statistics, or scan the population when there is no evaluation barrier
+	int i;
+	stats_reset(&generation_stats);
+	if(run_mode == MODE_STEADY){
+		//workers keep replacing members meanwhile, so read each one under its lock
+		for(i=0; i<population_size; i++){
+			pthread_mutex_lock(&slot_locks[i]);
+			double fitness = population[i].fitness;
+			int length = population[i].length;
+			pthread_mutex_unlock(&slot_locks[i]);
+			stats_add(&generation_stats, fitness, length, i);
+		}
+		return;
+	}
+	for(i=0; i<threads_per_rank; i++){
+		stats_merge(&generation_stats, &thread_stats[i]);
+	}
+}
+
+void merge_stats_op(void* in, void* inout, int* len, MPI_Datatype* type){
+	//MPI reduction op for PopulationStats
+	int i;
+	(void)type;
+	for(i=0; i<*len; i++){
+		stats_merge(&((PopulationStats*)inout)[i], &((PopulationStats*)in)[i]);
+	}
+}
+
+void print_stats(const PopulationStats* stats){
+	printf("\tMean fitness: %.5f (stddev %.5f)\n\tWorst fitness: %.5f\n", stats->mean, sqrt(stats_variance(stats)), stats->worst);
+	printf("\tMean notes: %.1f (%.0f bytes)\n\tLength diversity: %.3f\n", stats_mean_notes(stats), stats_mean_length(stats), stats_diversity(stats));
+}
+
+int check_stop(int generation, double local_best, double elapsed){
+	/*
+	
+	Decide whether to stop after this generation. The best fitness and the
+	elapsed time are reduced with a single MAX so every rank sees the same
+	numbers and reaches the same answer. Returns 0 to carry on, or a code
+	for the rule that fired.
+	
+	*/
+	double values[2] = {local_best, elapsed};
+	double global[2] = {local_best, elapsed};
+	if(run_mode != MODE_MASTER){
+		MPI_Allreduce(values, global, 2, MPI_DOUBLE, MPI_MAX, job_comm);
+	}
+	
+	if(global[0] > best_so_far){
+		best_so_far = global[0];
+		last_improvement = generation;
+	}
+	if(improvement_window > 0){
+		best_history[generation % (improvement_window + 1)] = best_so_far;
+	}
+	
+	if(target_difference > 0 && best_so_far >= 1000000000.0 / target_difference) return 1;
+	if(time_limit > 0 && global[1] >= time_limit) return 2;
+	if(stall_generations > 0 && generation - last_improvement >= stall_generations) return 3;
+	if(improvement_window > 0 && min_improvement > 0 && generation > improvement_window){
+		double before = best_history[(generation - improvement_window) % (improvement_window + 1)];
+		if(best_so_far - before < min_improvement * before) return 4;
+	}
 	return 0;
 }
 
-void* breed(void* input){
-	//do crossover and mutation
-	//Thread I is responsible for chromosomes (I*P/N to I*P/N + P/N).
-	t_data t_input = *((t_data *)input);
-	int threadID = t_input.threadid;
-	int chunk_size = population_size / threads_per_rank;
-	int remainder;
-	if(chunk_size == 0){
-		remainder = population_size;
+const char* stop_reason(int code){
+	if(code == 1) return "target difference score reached";
+	if(code == 2) return "time limit reached";
+	if(code == 3) return "no improvement within the stall window";
+	if(code == 4) return "improvement below the minimum";
+	return "";
+}
+
+void adapt_rates(int generation, const PopulationStats* stats){
+	/*
+	
+	Raise mutation the longer the best has been stuck and when genome
+	lengths have collapsed to a few sizes, ease it back towards the base
+	rate while things improve. Crossover is traded off against it.
+	Moves are smoothed so one noisy generation doesn't swing the rates.
+	
+	*/
+	int stalled = generation - last_improvement;
+	double target = base_mutation_rate * (1.0 + stalled / 10.0);
+	if(stats_diversity(stats) < 0.25) target *= 2;
+	if(target > 0.5) target = 0.5;
+	if(target < base_mutation_rate / 4) target = base_mutation_rate / 4;
+	rate_set(&mutation_rate, 0.7 * mutation_rate + 0.3 * target);
+	
+	double crossover_target = base_crossover_rate * ((stalled > 0) ? 0.8 : 1.0);
+	rate_set(&crossover_rate, 0.7 * crossover_rate + 0.3 * crossover_target);
+}
+
+chromosome get_best_chromosome(){
+	//the evaluate threads already found the best while scoring
+	max_fitness = generation_stats.best;
+	chromosome chromo;
+	copy_slot(&chromo, generation_stats.best_index);
+	return chromo;
+}
+
+MPI_Comm checkpoint_comm(){
+	//in master mode the whole population lives on rank 0, so it checkpoints alone
+	return (run_mode == MODE_MASTER) ? MPI_COMM_SELF : job_comm;
+}
+
+void save_checkpoint(Checkpoint* checkpoint, int generation, t_data* threadData){
+	/*
+	
+	Start an asynchronous checkpoint of the population about to be evaluated.
+	Steady-state threads are still running, so their slots are copied under
+	the slot locks and their rngs, which are in use, are left out.
+	
+	*/
+	int i;
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	header.population_size = population_size;
+	header.generation = generation;
+	header.max_generations = max_generations;
+	header.last_improvement = last_improvement;
+	header.mutation_rate = mutation_rate;
+	header.crossover_rate = crossover_rate;
+	header.best_so_far = best_so_far;
+	
+	int nrngs = (run_mode == MODE_STEADY) ? 1 : threads_per_rank + 1;
+	struct drand48_data* rngs = malloc(nrngs * sizeof(struct drand48_data));
+	rngs[0] = drand_buf;
+	for(i=1; i<nrngs; i++){
+		rngs[i] = threadData[i-1].rng;
+	}
+	chromosome* saved = population;
+	if(run_mode == MODE_STEADY){
+		for(i=0; i<population_size; i++){
+			copy_slot(&new_population[i], i);
+		}
+		saved = new_population;
+	}
+	if(!checkpoint_write(checkpoint, checkpoint_path, &header, saved, population_size, rngs, nrngs, checkpoint_comm()) && mpi_myrank == 0){
+		printf("error: generation %d was not checkpointed\n", generation);
+	}
+	free(rngs);
+}
+
+int load_checkpoint(t_data* threadData){
+	//replace the population with a checkpoint, returns the generation it was taken at or -1
+	int i, restored;
+	CheckpointHeader header;
+	int nrngs = (run_mode == MODE_STEADY) ? 1 : threads_per_rank + 1;
+	struct drand48_data* rngs = malloc(nrngs * sizeof(struct drand48_data));
+	if(!checkpoint_read(resume_path, &header, population, population_size, rngs, nrngs, &restored, checkpoint_comm())){
+		free(rngs);
+		return -1;
+	}
+	if(restored){
+		drand_buf = rngs[0];
+		for(i=1; i<nrngs; i++){
+			threadData[i-1].rng = rngs[i];
+		}
+	}
+	free(rngs);
+	best_so_far = header.best_so_far;
+	last_improvement = header.last_improvement;
+	mutation_rate = header.mutation_rate;
+	crossover_rate = header.crossover_rate;
+	if(mpi_myrank == 0){
+		printf("Resuming from %s at generation %d, written by %d rank(s)%s\n", resume_path, header.generation,
+			header.ranks, restored ? "" : ", population redistributed and rngs reseeded");
+	}
+	return header.generation;
+}
+
+int synthesize_goal(const char* spec, EvaluationGoal* synthetic){
+	/*
+	
+	Build a goal from seconds:notes per second:seed instead of reading one.
+	Random notes are decoded and rendered just like chromosomes, so any
+	length or density of workload can be made without a WAV file, and the
+	same spec always gives the same goal. Returns 0 on a bad spec, or one
+	too big to build.
+	
+	*/
+	double seconds = 0, density = 10;
+	unsigned int seed = 1;
+	if(sscanf(spec, "%lf:%lf:%u", &seconds, &density, &seed) < 1 || seconds <= 0 || density <= 0){
+		printf("error: synthetic goal should be synth:seconds:notes per second:seed, not synth:%s\n", spec);
+		return 0;
+	}
+	if(seconds * density > INT_MAX / NOTE_BYTES){
+		printf("error: synthetic goal synth:%s has too many notes\n", spec);
+		return 0;
 	}
-	else{
-		remainder = population_size % chunk_size;
+	int notes = (int)(seconds * density);
+	if(notes < 1) notes = 1;
+	unsigned short xsubi[3] = {0x330E, (unsigned short)seed, (unsigned short)(seed >> 16)};
+	char* genes = malloc((size_t)notes * NOTE_BYTES);
+	if(!genes){
+		printf("error: could not allocate the notes of synthetic goal synth:%s\n", spec);
+		return 0;
 	}
-	int start = threadID * chunk_size;
-	start += (threadID < remainder) ? threadID : remainder;
-	if (threadID < remainder) chunk_size += 1;
 	int i;
-	
-	for(i=start + 1; i < start + chunk_size; i+=2){
-		chromosome ch1 = *tournament_selection(8);
-		chromosome ch2 = *tournament_selection(8);
-		chromosome ret[2];//return buffer for new chromosomes
-		
-		//do crossover
-		if(randv() < crossover_rate){
-			one_point_crossover(ch1, ch2, ret);
-		}
-		else{
-			ret[0] = ch1;
-			ret[1] = ch2;
-		}
-		//do mutations
-		mutate(&ret[0]);
-		mutate(&ret[1]);
-		new_population[i-1] = ret[0];
-		new_population[i] = ret[1];
+	for(i=0; i<notes * NOTE_BYTES; i++){
+		genes[i] = (char)(erand48(xsubi) * 256);
 	}
+	double duration = (seconds < note_max_duration) ? seconds : note_max_duration;
+	Track track = track_initialize_from_binary(genes, notes * NOTE_BYTES, seconds, duration, frequency_max);
+	Audio audio = audio_initialize(seconds * SAMPLE_RATE);
+	track_audio_preallocated(&track, &audio);
+	int built = evaluation_goal_from_audio(synthetic, &audio, note_max_duration, frequency_max);
 	
-	return 0;
+	audio_free(&audio);
+	track_free(&track);
+	free(genes);
+	return built;
 }
 
-void one_point_crossover(chromosome ch1, chromosome ch2, chromosome* out){
-        //Perform one point crossover between two chromosomes
-		double r = randv();
-		//need to round to nearest note to prevent offset problem
-		
-        int r1 = ((int)(ch1.length * r / NOTE_BYTES)) * NOTE_BYTES;
-        int r2 = ((int)(ch2.length * r / NOTE_BYTES)) * NOTE_BYTES;
-		
-		//slice ch1 and ch2 and swap the partitions
-		int nlen1 = (r1 + ch2.length - r2);
-		int nlen2 = (r2 + ch1.length - r1);
-		chromosome newch1, newch2;
-		memcpy(newch1.genes, ch1.genes, ch1.length);//copy ch1 to newch1
-		memcpy(newch2.genes, ch2.genes, ch2.length);//copy ch2 to newch2
-		memcpy(newch1.genes + r1, ch2.genes + r2, ch2.length - r2);//copy right chunk of ch2 to right chunk of newch1
-		memcpy(newch2.genes + r2, ch1.genes + r1, ch1.length - r1);//copy right chunk of ch1 to right chunk of newch2
-		newch1.length = nlen1;
-		newch2.length = nlen2;
-		out[0] = newch1;
-		out[1] = newch2;
-}
-
-void mutate(chromosome* chromo){
-	//mutate a chromosome in place
-
-	int i,j;
-	for(i=0; i<chromo->length;i+=NOTE_BYTES){
-		switch(randr(0,2)){
-			case 0://insertion
-				if(randv() < mutation_rate){//randomly mutate based on mutation rate
-					if(chromo->length + NOTE_BYTES < MAX_GENES ){//only insert if room left in memory
-						memmove(chromo->genes + i + NOTE_BYTES, chromo->genes + i, chromo->length-i);
-						for(j=0;j<NOTE_BYTES;j++){
-							chromo->genes[i+j] = (char)randr(0,255);//RAND_CHAR;
-						}
-						chromo->length += NOTE_BYTES;
-					}
-				}
-				break;
-				
-			case 1://deletion
-				if(chromo->length != NOTE_BYTES){
-					if(randv() < mutation_rate){//randomly mutate based on mutation rate
-						if(chromo->length >= NOTE_BYTES + i ){//only insert if room left in memory
-							memmove(chromo->genes + i,chromo->genes + i + NOTE_BYTES,chromo->length-i-NOTE_BYTES);
-							chromo->length -= NOTE_BYTES;
-						}
-					}
-				}
-				break;
-				
-			case 2://substitution
-				for(j=0;j<NOTE_BYTES;j++){
-					if(randv() < mutation_rate){//randomly mutate based on mutation rate
-						chromo->genes[i+j] = (char)randr(0,255);//RAND_CHAR;
-					}
-				}
-				break;
-			
-			default:
-				printf("should not happen...\n");
+int golden_open(){
+	//start recording, or load the recording to check against, on rank 0, returns 0 on failure
+	const char* path = golden_path ? golden_path : golden_check_path;
+	golden_file = fopen(path, golden_path ? "w" : "r");
+	if(!golden_file){
+		printf("error: could not open golden file %s\n", path);
+		return 0;
+	}
+	//a recording only holds for the configuration that made it
+	char header[1024], recorded[1024], fitness[64] = "";
+	if(fitness_mode != FITNESS_BINS){
+		snprintf(fitness, sizeof(fitness), " fitness %s", evaluation_fitness_name(fitness_mode));
+	}
+	snprintf(header, sizeof(header), "# pgenalg golden: %d ranks %d threads %d population mode %d seed %u input %s%s\n",
+		mpi_commsize, threads_per_rank, population_size, (int)run_mode, base_seed, input_file, fitness);
+	if(golden_path){
+		fputs(header, golden_file);
+	}
+	else if(!fgets(recorded, sizeof(recorded), golden_file) || strcmp(header, recorded) != 0){
+		printf("error: golden file %s was recorded with a different configuration\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+void golden_generation(int generation, double best){
+	//record or check one generation's best fitness, on rank 0
+	if(golden_path){
+		fprintf(golden_file, "%d %.17g\n", generation, best);
+		fflush(golden_file);
+		return;
+	}
+	int recorded = 0;
+	double expected = 0;
+	//a resumed run starts partway through the recording
+	while(recorded < generation && fscanf(golden_file, "%d %lf", &recorded, &expected) == 2);
+	if(recorded != generation){
+		if(!golden_mismatch){
+			printf("error: golden file has no record of generation %d\n", generation);
+			golden_mismatch = generation;
 		}
+		return;
+	}
+	double difference = best - expected;
+	if(difference < 0) difference = -difference;
+	if(difference > golden_tolerance * ((expected < 0) ? -expected : expected) && !golden_mismatch){
+		printf("error: generation %d best fitness %.17g, golden %.17g\n", generation, best, expected);
+		golden_mismatch = generation;
 	}
 }
 
-chromosome* random_chromosome_from_population(){
-	//return pointer to a random chromosome in the population
-	int random_index = (int)(randv() * (population_size-1));
-	return population + random_index;
+void usage(){
+	//the arguments and options, printed by rank 0 when they don't parse
+	printf("Incorrect number of args\n\t[1] population_size\n\t[2] max_generations\n\t[3]threads_per_rank\n\t[4]generations_between_wav_output\n\t[5]input_file\n\t[6]output_directory\n");
+	printf("Options\n\t--topology=ring|hypercube|random|all\n\t--migration-interval=generations\n\t--migration-batch=chromosomes per neighbor\n\t--migration-neighbors=out-degree for random topology\n\t--migration-lag=migrations a batch may stay in flight\n\t--mode=island|master|steady\n\t--eval-batch=chromosomes per batch in master mode\n\t--lookahead=batches queued per worker in master mode\n\t--selection=tournament|rank|roulette\n\t--tournament-size=k\n\t--stall=generations without improvement before stopping\n\t--target=difference score to stop at\n\t--time-limit=seconds of wall-clock time\n\t--min-improvement=fraction the best must improve by within\n\t--improvement-window=generations\n\t--adaptive adjust mutation and crossover rates as the run progresses\n\t--global-stats reduce statistics over every rank\n\t--subislands breed within per-thread slices\n\t--subisland-migrants=chromosomes passed between threads each generation\n\t--checkpoint=file to write the population to\n\t--checkpoint-interval=generations between checkpoints\n\t--resume=checkpoint file to start from\n\t--store=file to map the population from instead of RAM\n\t--elite-cache=fittest members kept in RAM with --store\n\t--metrics=file to write per-generation timings to, as JSON Lines\n\t--perf add hardware counters per stage to --metrics\n\t--trace=file to write a Chrome trace of every thread to\n\t--trace-events=spans kept per thread for --trace\n\t--seed=base seed for every rank and thread\n\t--deterministic refuse settings that make runs unrepeatable\n\t--golden=file to record the best fitness of each generation to\n\t--golden-check=file to check each generation's best fitness against\n\t--golden-tolerance=relative difference allowed by --golden-check\n\t--pin=none|compact|scatter|cpu list like 0,2,4-7 to pin threads to\n\t--hugepages=off|thp|explicit for the population and render buffers\n\t--fitness=bins|bands|sparse compare every spectrum bin, log band energies, or the goal's significant bins\n");
+	printf("input_file may be synth:seconds:notes per second:seed to generate the goal instead\n");
+	printf("or: pgenalg --manifest=file [--groups=N] to run one job per line of file, each line holding the arguments and options above\n");
+	printf("or: pgenalg --serve=socket to stay up and run what pgenalg-client sends to the socket\n");
 }
 
-chromosome* tournament_selection(int tournament_size){
-		//returns pointer to the most fit candidate from tournament of size <tournament_size>
-        chromosome* best = random_chromosome_from_population();
-		int i;
-		for(i=0; i<tournament_size; i++){
-            chromosome* chromo = random_chromosome_from_population();
-			if(chromo->fitness > best->fitness){//assumes higher fitness is better
-				best = chromo;
-			}
-		}
-        return best;
+int read_goal_file(char* input){
+	/*
+	
+	Read a .wav goal with every rank and thread. Each rank transforms a
+	contiguous slice of the blocks, streamed from the file by all of its
+	threads, and the slices are then gathered so every rank holds the
+	whole spectrum. Collective over job_comm, returns 0 on failure.
+	
+	*/
+	int i, ok = evaluation_goal_open(&goal, input, note_max_duration, frequency_max);
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, job_comm);
+	if(!ok){
+		evaluation_goal_free(&goal);
+		return 0;
+	}
+	int blocks = evaluation_goal_block_count(&goal);
+	int* counts = malloc(mpi_commsize * sizeof(int));
+	int* displacements = malloc(mpi_commsize * sizeof(int));
+	for(i=0; i<mpi_commsize; i++){
+		int first = (int)((long long)blocks * i / mpi_commsize);
+		int next = (int)((long long)blocks * (i + 1) / mpi_commsize);
+		counts[i] = (next - first) * (int)blockSize;
+		displacements[i] = first * (int)blockSize;
+	}
+	ok = evaluation_goal_blocks(&goal, input, displacements[mpi_myrank] / (int)blockSize, counts[mpi_myrank] / (int)blockSize, threads_per_rank);
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, job_comm);
+	if(ok){
+		//each block is blockSize / 2 bins of two doubles
+		MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, goal.values, counts, displacements, MPI_DOUBLE, job_comm);
+	}
+	else{
+		evaluation_goal_free(&goal);
+	}
+	free(counts);
+	free(displacements);
+	return ok;
 }
 
-chromosome get_best_chromosome(){
-	int i;
-	max_fitness = -1;
-	chromosome* chromo = NULL;
-	for(i=0; i<population_size; i++){
-		chromosome tmp = population[i];
-		if(tmp.fitness > max_fitness){
-			max_fitness = tmp.fitness;
-			chromo = &population[i];
+int load_goal(char* input){
+	//build the goal for input, or take it from the cache when an earlier job already built it
+	int i, read;
+	for(i=0; i<goal_cache_count; i++){
+		if(strcmp(goal_cache[i].input, input) == 0 && goal_cache[i].goal.mode == fitness_mode){
+			goal = goal_cache[i].goal;
+			SAMPLE_RATE = goal.sample_rate;
+			return 1;
 		}
 	}
-	return *chromo;
+	SAMPLE_RATE = default_sample_rate;
+	if(strncmp(input, "synth:", 6) == 0){
+		read = synthesize_goal(input + 6, &goal);
+	}
+	else{
+		read = read_goal_file(input);
+	}
+	if(read && !evaluation_goal_set_mode(&goal, fitness_mode)){
+		evaluation_goal_free(&goal);
+		read = 0;
+	}
+	if(read && cache_goals){
+		goal_cache = realloc(goal_cache, (goal_cache_count + 1) * sizeof(CachedGoal));
+		goal_cache[goal_cache_count].input = strdup(input);
+		goal_cache[goal_cache_count].goal = goal;
+		goal_cache_count++;
+	}
+	return read;
 }
 
-int main(int argc, char *argv[]){
+int run_job(MPI_Comm comm, int argc, char *argv[]){
+	/*
+	
+	One evolution on the ranks of comm, from the same arguments main takes.
+	Every setting starts from its default, and everything the job sets up
+	is released again, so jobs can run one after another in a process.
+	Returns nonzero if the job failed or its golden check didn't match.
+	
+	*/
 	double starttime, endtime;
 
-	//initialize MPI for K ranks
-	MPI_Init(&argc, &argv);
-	MPI_Comm_size(MPI_COMM_WORLD, &mpi_commsize);
-	MPI_Comm_rank(MPI_COMM_WORLD, &mpi_myrank);
+	job_comm = comm;
+	MPI_Comm_size(job_comm, &mpi_commsize);
+	MPI_Comm_rank(job_comm, &mpi_myrank);
+	default_options();
 
 	starttime = MPI_Wtime();
 
-	if(argc != 7){
+	if(argc < 7 || !parse_options(argc, argv, 7)){
 		if(mpi_myrank == 0){
-			printf("Incorrect number of args\n\t[1] population_size\n\t[2] max_generations\n\t[3]threads_per_rank\n\t[4]generations_between_wav_output\n\t[5]input_file\n\t[6]output_directory\n");
+			usage();
 		}
-		MPI_Finalize();
-		return 0;
+		return 1;
 	}
 	population_size = atoi(argv[1]);
 	max_generations = atoi(argv[2]); 
 	if (max_generations <= 0) max_generations = INT_MAX;
 	threads_per_rank = atoi(argv[3]);
 	if (threads_per_rank <= 0) threads_per_rank = 1;
+	//every thread breeds and draws from a slice of its own, so none may be empty
+	if (population_size < threads_per_rank) {
+		if(mpi_myrank == 0){
+			printf("error: population_size %d is smaller than threads_per_rank %d\n", population_size, threads_per_rank);
+		}
+		return 1;
+	}
 	int generations_between_wav_output = atoi(argv[4]);
 	if (generations_between_wav_output <= 0) generations_between_wav_output = INT_MAX;
-	char* input_file = argv[5];
+	input_file = argv[5];
 	char* output_directory = argv[6];
 	//create output filename
 	char out_filename[100];
@@ -286,95 +1457,66 @@ int main(int argc, char *argv[]){
     	if(mpi_myrank == 0){ 
     		printf("error: Invalid output directory %s\n", output_directory);
     	}
-    	MPI_Finalize();
-		return 0;
+		return 1;
     }
 	fprintf(fout, "%s \tfilename\n%d \t\tranks\n%d \t\tthreads/rank\n%d \t\tpopulation\n%d \t\tgenerations\n", input_file, mpi_commsize, threads_per_rank, population_size, max_generations);
     fclose(fout);
 	
 	//read input file
-	unsigned int sample_rate = 0;
-	unsigned int sample_count = 0;
-	file_dft_length = ReadAudioFile(input_file, &file_dft_data, &sample_rate, &sample_count);
-	if(file_dft_length == 0){
+	double read_start = MPI_Wtime();
+	if(!load_goal(input_file)){
 		//error while reading in file
-		MPI_Finalize();
-		return 0;
-	}
-	song_max_duration = (sample_count * 1.0 / sample_rate);
-	song_max_samples = sample_count;
-	if (song_max_duration < note_max_duration) {
-		note_max_duration = song_max_duration;
+		return 1;
 	}
-	SAMPLE_RATE = sample_rate;
 	if (mpi_myrank == 0) {
-		printf("Input File:\n\tDuration: %f\n\tSample Rate: %u\n", song_max_duration, sample_rate);
+		printf("Input File:\n\tDuration: %f\n\tSample Rate: %u\n\tRead in: %.3f seconds\n\tFitness: %s\n", goal.duration, SAMPLE_RATE,
+			MPI_Wtime() - read_start, evaluation_fitness_name(goal.mode));
+		if(goal.mode == FITNESS_SPARSE){
+			printf("\tSignificant bins: %.2f%%\n", 100.0 * goal.sparse.offsets[goal.sparse.blocks] / ((double)goal.blocks * (blockSize / 2)));
+		}
 	}
 
 	int i,j,generation;//loop vars
+	
+	//timing decides how steady-state threads interleave and when the clock runs out, sub-islands wait at a barrier instead
+	if(deterministic && (run_mode == MODE_STEADY || time_limit > 0)){
+		if(mpi_myrank == 0){
+			printf("error: --deterministic can't be used with --mode=steady or --time-limit\n");
+		}
+		if(!cache_goals) evaluation_goal_free(&goal);
+		return 1;
+	}
+	migration_config.seed = base_seed;
 
 	//set RNG seed	
-	srand48_r (1202107158 + mpi_myrank * 1999, &drand_buf);
+	srand48_r (base_seed + mpi_myrank * 1999, &drand_buf);
 	
-	//MPI_Request request;
-	MPI_Status status;
+	/*
 	
-	pthread_t* threads = malloc(threads_per_rank * sizeof(pthread_t));
-	t_data* threadData = malloc(threads_per_rank * sizeof(t_data));
+	Setup below can fail on any rank. Every fallible step is agreed with
+	the other ranks of the job before the next collective one, and a
+	failure unwinds through cleanup with status 1, so one bad job never
+	takes down the rest of the process.
 	
-	//create initial population
-	population = malloc(population_size * sizeof(chromosome));
-	new_population = malloc(population_size * sizeof(chromosome));
-
-	//create a plan for each thread
-	for(i = 0; i<threads_per_rank; i++){
-		threadData[i].threadid = i;
-		
-		threadData[i].audio = audio_initialize(song_max_samples);
-
-		threadData[i].fftw_in = fftw_malloc( sizeof(double) * blockSize2);
-	    if ( !threadData[i].fftw_in ) {
-			printf("error: fftw_malloc 1 failed\n");
-			for( j=0; j < i; j++ ){
-				audio_free( &threadData[i].audio );
-				fftw_free( threadData[j].fftw_in );
-				fftw_destroy_plan( threadData[j].plan );
-				fftw_free( threadData[j].fftw_out );
-			}
-			free( threadData );
-			free( threads );
-			return 0;
-		}
-
-		threadData[i].fftw_out = fftw_malloc( sizeof(fftw_complex) * blockSize2 );
-	    if ( !threadData[i].fftw_out ) {
-			printf("error: fftw_malloc 2 failed\n");
-			for( j=0; j < i; j++ ){
-				fftw_free( threadData[j].fftw_in );
-				fftw_destroy_plan( threadData[j].plan );
-				fftw_free( threadData[j].fftw_out );
-			}
-			fftw_free( threadData[i].fftw_in );
-			free( threadData );
-			free( threads );
-			return 0;
-	    }
-
-		threadData[i].plan = fftw_plan_dft_r2c_1d( blockSize2, threadData[i].fftw_in, threadData[i].fftw_out, FFTW_MEASURE );
-		if ( !threadData[i].plan ) {
-			printf("error: Could not create plan\n");
-			for( j=0; j < i; j++ ){
-				fftw_free( threadData[j].fftw_in );
-				fftw_destroy_plan( threadData[j].plan );
-				fftw_free( threadData[j].fftw_out );
-			}
-			fftw_free( threadData[i].fftw_in );
-			fftw_free( threadData[i].fftw_out );
-			free( threadData );
-			free( threads );
-			return 0;
-		}
-	}
+	*/
+	int status = 1;
+	int snapshot_started = 0;
+	t_snapshot snapshot;
+	Migration migration;
+	memset(&migration, 0, sizeof(Migration));
+	Checkpoint checkpoint;
+	checkpoint_initialize(&checkpoint);
+	chromosome** emigrants = NULL;
+	chromosome* emigrant_copies = NULL;
+	chromosome* immigrants = NULL;
+	int batch_size = 0;
+	int first_generation = 1;
+	base_mutation_rate = mutation_rate;
+	base_crossover_rate = crossover_rate;
+	
+	pthread_t* threads = malloc(threads_per_rank * sizeof(pthread_t));
+	t_data* threadData = calloc(threads_per_rank, sizeof(t_data));
+	pthread_barrier_init(&thread_barrier, NULL, threads_per_rank);
 	
 	/* create a mpi struct for chromosome */
     int blocklengths[3] = {MAX_GENES,1,1};
@@ -387,164 +1529,761 @@ int main(int argc, char *argv[]){
     MPI_Type_create_struct(3, blocklengths, offsets, types, &MPI_CHROMO);
     MPI_Type_commit(&MPI_CHROMO);
 	
-	for(i=0; i<population_size;i++){
-		chromosome tmp;
-		tmp.fitness = 0;
-		int length = randr(150,250)*NOTE_BYTES;//start chromosomes between with random size
-		tmp.length = length;
-		for(j=0;j<length;j++){//assign random char values (0-255)
-			tmp.genes[j] = (char)randr(0,255);//RAND_CHAR;
+	/* and a byte struct plus merge op for population statistics */
+	MPI_Datatype MPI_STATS;
+	MPI_Op MPI_MERGE_STATS;
+	MPI_Type_contiguous(sizeof(PopulationStats), MPI_BYTE, &MPI_STATS);
+	MPI_Type_commit(&MPI_STATS);
+	MPI_Op_create(merge_stats_op, 1, &MPI_MERGE_STATS);
+	
+	if(!agree(threads && threadData) || !agree(placement_initialize(&placement, threads_per_rank, job_comm))){
+		goto cleanup;
+	}
+	int ok = 1;
+	
+	//in master mode every other rank only evaluates what rank 0 sends it, and keeps no population
+	int is_worker = (run_mode == MODE_MASTER && mpi_myrank != 0);
+	
+	//create initial population, in RAM or mapped from a file per rank
+	if(is_worker){
+		population = NULL;
+		new_population = NULL;
+	}
+	else if(store_path){
+		char rank_path[512];
+		snprintf(rank_path, sizeof(rank_path), "%s.%d", store_path, mpi_myrank);
+		if(!store_initialize(&store, rank_path, population_size) || !elite_initialize(&elites, elite_cache_size, population_size)){
+			ok = 0;
+		}
+		population = store_population(&store, 0);
+		new_population = store_population(&store, 1);
+	}
+	else{
+		population = placement_alloc(&placement, population_size * sizeof(chromosome));
+		new_population = placement_alloc(&placement, population_size * sizeof(chromosome));
+		if(!population || !new_population){
+			printf("error: could not allocate the population\n");
+			ok = 0;
+		}
+	}
+	//the placement report below is collective, so every rank has to get this far
+	if(!agree(ok)){
+		goto cleanup;
+	}
+	
+	//each thread allocates its own buffers, on the cpu it will keep running on
+	for(i = 0; i<threads_per_rank; i++){
+		threadData[i].threadid = i;
+		srand48_r (base_seed + mpi_myrank * 1999 + (i + 1) * 7919, &threadData[i].rng);
+		pthread_create(&threads[i], placement_attr(&placement, i), allocate_thread_buffers, &threadData[i]);
+	}
+	for(i = 0; i<threads_per_rank; i++){
+		pthread_join(threads[i], NULL);
+	}
+	if(placement.policy != PIN_NONE || placement.hugepages != HUGEPAGES_OFF){
+		placement_report(&placement);
+	}
+	for(i = 0; i<threads_per_rank; i++){
+		if ( !threadData[i].eval.plan ) {
+			printf("error: could not set up evaluation for thread %d\n", i);
+			ok = 0;
+		}
+	}
+	thread_stats = malloc(threads_per_rank * sizeof(PopulationStats));
+	best_history = calloc(improvement_window + 1, sizeof(double));
+	if(!agree(ok && thread_stats && best_history)){
+		goto cleanup;
+	}
+	
+	if(perf_stages && !metrics_path && mpi_myrank == 0){
+		printf("warning: --perf needs --metrics\n");
+	}
+	if(!agree(!metrics_path || metrics_initialize(&metrics, metrics_path, threads_per_rank, perf_stages, job_comm))){
+		goto cleanup;
+	}
+	//tracks for the threads, the main thread and the snapshot writer
+	if(trace_path){
+		if(!trace_initialize(trace_path, threads_per_rank + 2, trace_events, job_comm)){
+			goto cleanup;
+		}
+		trace_thread(threads_per_rank, "main");
+	}
+	
+	if(mpi_myrank == 0){
+		snapshot_started = snapshot_initialize(&snapshot, output_directory);
+		ok = snapshot_started;
+	}
+	
+	ok = ok && migration_initialize(&migration, &migration_config, job_comm);
+	if(!agree(ok)){
+		goto cleanup;
+	}
+	batch_size = migration.config.batch_size;
+	int peers = (mpi_commsize > 1) ? (mpi_commsize - 1) : 1;
+	emigrants = malloc(peers * batch_size * sizeof(chromosome*));
+	emigrant_copies = malloc(peers * batch_size * sizeof(chromosome));
+	immigrants = malloc(peers * batch_size * sizeof(chromosome));
+	ok = (emigrants && emigrant_copies && immigrants);
+	if (mpi_myrank == 0 && run_mode == MODE_MASTER) {
+		printf("Master mode: %d worker(s), batches of %d, lookahead %d\n", mpi_commsize - 1, eval_batch_size, eval_lookahead);
+	}
+	else if (mpi_myrank == 0 && mpi_commsize > 1) {
+		printf("Migration: %s topology, %d chromosome(s) every %d generation(s), lag %d\n",
+			migration_topology_name(migration.config.topology), batch_size, migration.config.interval, migration.config.lag);
+	}
+	
+	ok = ok && selector_initialize(&selector, selection_scheme, tournament_size, population_size, threads_per_rank);
+	
+	if(ok && subislands){
+		//each thread owns a slice, allocated on first touch by that thread
+		thread_queues = calloc(threads_per_rank, sizeof(ChromosomeQueue));
+		ok = (thread_queues != NULL);
+		for(i=0; ok && i<threads_per_rank; i++){
+			ok = queue_initialize(&thread_queues[i], 2 * subisland_migrants);
+		}
+		if(ok && !is_worker) run_threads(initialize_population, threads, threadData, &migration);
+	}
+	else if(ok && !is_worker){
+		for(i=0; i<population_size;i++){
+			chromosome tmp;
+			tmp.fitness = 0;
+			int length = randr(150,250)*NOTE_BYTES;//start chromosomes between with random size
+			tmp.length = length;
+			for(j=0;j<length;j++){//assign random char values (0-255)
+				tmp.genes[j] = (char)randr(0,255);//RAND_CHAR;
+			}
+			copy_chromosome(&population[i], &tmp);
+			///printf("Rank: %d chromo: <%.*s> %d \n",mpi_myrank,tmp.length,tmp.genes,tmp.length);
 		}
-		population[i] = tmp;
-		///printf("Rank: %d chromo: <%.*s> %d \n",mpi_myrank,tmp.length,tmp.genes,tmp.length);
+	}
+	if(!agree(ok)){
+		goto cleanup;
 	}
 	
-	MPI_Barrier(MPI_COMM_WORLD);	
+	//pick up where a checkpoint left off
+	if(resume_path && !is_worker){
+		int resumed = load_checkpoint(threadData);
+		ok = (resumed >= 0);
+		first_generation = resumed + 1;
+	}
 	
+	if (mpi_myrank == 0 && ok) {
+		if(golden_path || golden_check_path){
+			ok = golden_open();
+		}
+	}
+	if(!agree(ok)){
+		goto cleanup;
+	}
 	if (mpi_myrank == 0) {
 		printf("Running\n");
 	}	
 	
+	if(is_worker){
+		evaluation_worker(threads, threadData, &migration);
+	}
+	
+	//in steady-state mode the threads run continuously once the first population is scored,
+	//and the generation loop below only marks every population_size evaluations
+	if(run_mode == MODE_STEADY){
+		slot_locks = malloc(population_size * sizeof(pthread_mutex_t));
+		for(i=0; i<population_size; i++){
+			pthread_mutex_init(&slot_locks[i], NULL);
+		}
+		eval_population = population;
+		eval_count = population_size;
+		run_threads(evaluate, threads, threadData, &migration);
+		steady_budget = (long long)(max_generations - first_generation + 1) * population_size;
+		steady_claimed = 0;
+		steady_evaluations = 0;
+		steady_stop = 0;
+		start_threads(steady_worker, threads, threadData);
+	}
+	
 	//run for max_generations
-	for(generation=1; generation <= max_generations; generation++){
+	for(generation=first_generation; !is_worker && generation <= max_generations; generation++){
 
 		/* 
 		
 		For population_size P and threads_per_rank N, N threads	evaluate
 		the population, each thread being responsible for P/N chromosomes. 
+		In master mode the population is sent out in batches instead.
 		
 		*/
 		
-		for (i = 0; i < threads_per_rank; i++) {
-			pthread_create(&threads[i], NULL, evaluate, &(threadData[i]));
+		double span = trace_start();
+		if(run_mode == MODE_STEADY){
+			steady_wait((long long)(generation - first_generation + 1) * population_size, &migration);
 		}
-		for (i = 0; i < threads_per_rank; i++) {
-			pthread_join(threads[i], NULL);
+		else if(run_mode == MODE_MASTER && mpi_commsize > 1){
+			//rank 0's own evaluations count themselves
+			metrics_count(dispatch_evaluation(threads, threadData));
+		}
+		else{
+			eval_population = population;
+			eval_count = population_size;
+			run_threads(evaluate, threads, threadData, &migration);
+		}
+		trace_span("evaluation", span);
+		
+		//join the selection tables the threads built for their slices
+		if(run_mode == MODE_MASTER && mpi_commsize > 1){
+			run_threads(prepare_selection, threads, threadData, &migration);
+		}
+		if(run_mode != MODE_STEADY){
+			double phase = metrics_start();
+			selector_finish(&selector, 1);
+			metrics_stop(PHASE_SELECTION, phase);
 		}
 		
+		gather_stats();
 		chromosome best_chromo = get_best_chromosome();
 		
+		//the best over every rank goes to the golden file
+		if(golden_path || golden_check_path){
+			double best = max_fitness;
+			if(run_mode != MODE_MASTER){
+				MPI_Reduce(&max_fitness, &best, 1, MPI_DOUBLE, MPI_MAX, 0, job_comm);
+			}
+			if(mpi_myrank == 0){
+				golden_generation(generation, best);
+			}
+		}
+		
+		//statistics over every rank, or just this one
+		PopulationStats all_stats = generation_stats;
+		if(global_stats && run_mode != MODE_MASTER){
+			MPI_Reduce(&generation_stats, &all_stats, 1, MPI_STATS, MPI_MERGE_STATS, 0, job_comm);
+		}
+		
+		//check the stopping rules, and let the rates follow progress
+		int stopping = 0;
+		if(stall_generations > 0 || target_difference > 0 || time_limit > 0 || improvement_window > 0 || adaptive_rates){
+			span = trace_start();
+			stopping = check_stop(generation, max_fitness, MPI_Wtime() - starttime);
+			trace_span("stop check", span);
+		}
+		if(adaptive_rates){
+			adapt_rates(generation, &generation_stats);
+		}
+		
 		//do global exchange
-		if(generation%generations_between_wav_output==0 || generation == max_generations){
-			if(mpi_myrank == 0){//recv best from everything
-				chromosome recv;
-				int best_rank = 0;
-				for(i=1;i<mpi_commsize;i++){
-					MPI_Recv(&recv, 1, MPI_CHROMO, i, 1234, MPI_COMM_WORLD, &status);
-					if(recv.fitness > best_chromo.fitness){
-						best_chromo = recv;
-						best_rank = i;
-					}
-				}	
+		double phase = metrics_start();
+		if(generation%generations_between_wav_output==0 || generation == max_generations || stopping){
+			//find the best rank collectively, then have it broadcast its chromosome
+			struct {
+				double fitness;
+				int rank;
+			} local_best, global_best;
+			local_best.fitness = best_chromo.fitness;
+			local_best.rank = mpi_myrank;
+			global_best = local_best;
+			if(run_mode != MODE_MASTER){
+				MPI_Allreduce(&local_best, &global_best, 1, MPI_DOUBLE_INT, MPI_MAXLOC, job_comm);
+				MPI_Bcast(&best_chromo, 1, MPI_CHROMO, global_best.rank, job_comm);
+			}
+			
+			if(mpi_myrank == 0){
+				printf("Best among all populations:\nRank: %d\nGeneration %d:\n\tMax fitness: %.5f\n",global_best.rank,generation,global_best.fitness);
 				
-				printf("Best among all populations:\nRank: %d\nGeneration %d:\n\tMax fitness: %.5f\n",best_rank,generation,max_fitness);
+				print_stats(&all_stats);
 				
-				//do detailed output
-				Track track = track_initialize_from_binary(best_chromo.genes, best_chromo.length, song_max_duration, note_max_duration, frequency_max);
-				Audio* audio = &(threadData[0].audio);
-				track_audio_preallocated(&track, audio);
-				char fname[256];
-				sprintf(fname, "%s/audio_result_%d.wav", output_directory, generation);
-				double similarity = AudioComparison(audio->samples, audio->count, file_dft_data, file_dft_length, &(threadData[0].fftw_in), &(threadData[0].fftw_out), &(threadData[0].plan) );
-				printf("\tDifference Score: %.0f\n", similarity);
-				audio_save(audio, fname);
-				printf("\tNotes: %d (%d bytes)\n", track.count, best_chromo.length);
-				double freqMax = DBL_MIN; double freqMin = DBL_MAX;
-				double volMax = DBL_MIN; double volMin = DBL_MAX;
-				double durMax = DBL_MIN; double durMin = DBL_MAX;
-				for (i = 0; i < track.count; ++i) {
-					Note* note = &track.notes[i];
-					if (note->frequency < freqMin) freqMin = note->frequency;
-					if (note->frequency > freqMax) freqMax = note->frequency;
-					if (note->volume < volMin) volMin = note->volume;
-					if (note->volume > volMax) volMax = note->volume;
-					if (note->duration < durMin) durMin = note->duration;
-					if (note->duration > durMax) durMax = note->duration;
-				}
-				printf("\tFrequency: %.0f - %.0f\n", freqMin, freqMax);
-				printf("\tVolume: %.3f - %.3f\n", volMin, volMax);
-				printf("\tDuration: %.3f - %.3f\n", durMin, durMax);
-				track_free(&track);
-			}
-			else{//else send best to rank 0
-				MPI_Send(&best_chromo, 1, MPI_CHROMO, 0, 1234, MPI_COMM_WORLD);
+				//detailed output happens on the writer thread
+				snapshot_submit(&snapshot, &best_chromo, generation);
 			}
 		}else{
 			if(mpi_myrank == 0){//recv best from everything
 				//else just print for rank 0
 				printf("Rank 0 Best\nGeneration %d:\n\tMax fitness: %.5f\n",generation,max_fitness);
+				print_stats(&all_stats);
 			}
 			
 		}
+		if(adaptive_rates && mpi_myrank == 0){
+			printf("\tMutation rate: %.4f\n\tCrossover rate: %.4f\n", mutation_rate, crossover_rate);
+		}
+		metrics_stop(PHASE_OUTPUT, phase);
+		if(stopping){
+			if(mpi_myrank == 0){
+				printf("Stopping at generation %d: %s\n", generation, stop_reason(stopping));
+			}
+			if(metrics_path){
+				metrics_record(&metrics, generation, migration.bytes_sent, run_mode != MODE_MASTER);
+			}
+			break;
+		}
 		
 		/*
 		
-		After all P chromosomes have been evaluated, P/(K-1) chromosomes are
-		randomly chosen to be distributed among the other (K-1) populations. 
+		Every migration interval, each rank posts a packed batch of
+		tournament-selected chromosomes to its neighbors in the topology.
+		The batch posted <lag> migrations ago is then completed, so with a
+		lag the transfer overlaps the breeding and evaluation in between.
+		Immigrants overwrite random members of the population.
 		
 		*/
 
-		//exchange one chromosome with every other population
-		for(i=0; i<mpi_commsize; i++){
-			if(i ==  mpi_myrank){//don't send to self
-				continue;
-			}else{
-				chromosome* tmp = tournament_selection(8);//fitness-based random chromo to exchange
-				///printf("rank %d sent <%.*s> %.5f to rank %d\n",mpi_myrank,tmp->length,tmp->genes,tmp->fitness,i);
-				chromosome recv;				
-				MPI_Sendrecv(tmp, 1, MPI_CHROMO, i, 0, &recv, 1, MPI_CHROMO, i, 0, MPI_COMM_WORLD, &status);
-				*tmp = recv;
-				///printf("rank %d received <%.*s> %.5f from rank %d\n",mpi_myrank,tmp->length,tmp->genes,tmp->fitness,i);
+		if(run_mode != MODE_MASTER && generation % migration.config.interval == 0){
+			phase = metrics_start();
+			int epoch = generation / migration.config.interval;
+			int nsend = migration_neighbors(&migration, epoch);
+			for(i=0; i<nsend * batch_size; i++){
+				//fitness-based random chromo to exchange
+				int index = (run_mode == MODE_STEADY) ? steady_tournament(tournament_size, 1) : selector_draw(&selector);
+				copy_slot(&emigrant_copies[i], index);
+				emigrants[i] = &emigrant_copies[i];
+			}
+			migration_post(&migration, epoch, emigrants, job_comm);
+			if(epoch - migration.config.lag >= 1){
+				int received = migration_complete(&migration, epoch - migration.config.lag, immigrants);
+				for(i=0; i<received; i++){
+					int index = random_chromosome_from_population() - population;
+					store_slot(&immigrants[i], index);
+					if(run_mode != MODE_STEADY) selector_update(&selector, index, immigrants[i].fitness);
+				}
+				//rank and roulette tables have to be built again to draw the immigrants
+				if(received > 0 && run_mode != MODE_STEADY && selection_scheme != SELECT_TOURNAMENT){
+					run_threads(prepare_selection, threads, threadData, &migration);
+					selector_finish(&selector, 1);
+				}
 			}
-		}	
+			metrics_stop(PHASE_MIGRATION, phase);
+		}
 		
 		/*
 		
 		After each rank receives the chromosomes from the other populations,
 		it begins the crossover sequence.
 		
-		Crossover occurs on N threads.
+		Crossover occurs on N threads. Steady-state threads breed on their own.
 		
 		*/
 		
-		for (i = 0; i < threads_per_rank; i++) {
-			pthread_create(&threads[i], NULL, breed, &(threadData[i]));
+		if(run_mode != MODE_STEADY){
+			if(store_path){
+				elite_fill(&elites, population, selector.fitness);
+			}
+			span = trace_start();
+			run_threads(breed, threads, threadData, &migration);
+			trace_span("breeding", span);
+			
+			//switch to new population
+			chromosome* swap = population;
+			population = new_population;
+			new_population = swap;
 		}
-		for (i = 0; i < threads_per_rank; i++) {
-			pthread_join(threads[i], NULL);
+		
+		//the write overlaps the following generations
+		if(checkpoint_path && generation % checkpoint_interval == 0){
+			span = trace_start();
+			save_checkpoint(&checkpoint, generation, threadData);
+			trace_span("checkpoint", span);
 		}
 		
-		//switch to new population
-		for(i=0; i<population_size;i++){
-			population[i] = new_population[i];
+		if(metrics_path){
+			metrics_record(&metrics, generation, migration.bytes_sent, run_mode != MODE_MASTER);
 		}
 
 	}
 
-	MPI_Barrier(MPI_COMM_WORLD);	
+	if(run_mode == MODE_STEADY){
+		steady_stop = 1;
+		for(i=0; i<threads_per_rank; i++){
+			pthread_join(threads[i], NULL);
+		}
+		for(i=0; i<population_size; i++){
+			pthread_mutex_destroy(&slot_locks[i]);
+		}
+		free(slot_locks);
+		slot_locks = NULL;
+	}
+	migration_drain(&migration);
+	checkpoint_finish(&checkpoint);
+	if(run_mode == MODE_MASTER && mpi_myrank == 0){
+		stop_workers();
+	}
+	if(snapshot_started){
+		snapshot_free(&snapshot);
+		snapshot_started = 0;
+	}
+	if(golden_file){
+		fclose(golden_file);
+		golden_file = NULL;
+		if(golden_check_path && !golden_mismatch){
+			printf("Golden check passed\n");
+		}
+	}
+	MPI_Barrier(job_comm);	
+	trace_write();
 
 	if(mpi_myrank == 0){ 
 		endtime = MPI_Wtime();
 		FILE* fout = fopen(out_filename, "a");	
-		fprintf(fout, "%f \tTotalTime\n%.3f \tMax Fitness\n", endtime - starttime, max_fitness);
+		fprintf(fout, "%f \tTotalTime\n%.3f \tMax Fitness\n%d \tGenerations Run\n", endtime - starttime, max_fitness, (generation > max_generations) ? max_generations : generation);
 		fclose(fout);
     }
 
-	MPI_Finalize();
+	status = (golden_mismatch != 0);
 
-	for( i=0; i < threads_per_rank; i++ ){
-		audio_free( &threadData[i].audio );
-		fftw_free( threadData[i].fftw_in );
-		fftw_free( threadData[i].fftw_out );
-		fftw_destroy_plan( threadData[i].plan );
+cleanup:
+	//a job that failed in setup still has whatever it got as far as starting
+	if(snapshot_started){
+		snapshot_free(&snapshot);
+	}
+	if(golden_file){
+		fclose(golden_file);
+		golden_file = NULL;
+	}
+	trace_discard();
+	for( i=0; threadData && i < threads_per_rank; i++ ){
+		placement_release( &placement, threadData[i].eval.audio.samples, goal.samples * sizeof(Sample) );
+		evaluation_free( &threadData[i].eval );
 	}
 	free( threadData );
+	if(!cache_goals) evaluation_goal_free( &goal );
 
 	free( threads );
-	free(population);
-	free(new_population);
+	if(store_path){
+		store_free(&store);
+		elite_free(&elites);
+	}
+	else{
+		placement_release(&placement, population, population_size * sizeof(chromosome));
+		placement_release(&placement, new_population, population_size * sizeof(chromosome));
+	}
+	population = NULL;
+	new_population = NULL;
+	placement_free(&placement);
+	free(emigrants);
+	free(emigrant_copies);
+	selector_free(&selector);
+	pthread_barrier_destroy(&thread_barrier);
+	metrics_free(&metrics);
+	free(thread_stats);
+	thread_stats = NULL;
+	free(best_history);
+	best_history = NULL;
+	if(thread_queues){
+		for(i=0; i<threads_per_rank; i++){
+			queue_free(&thread_queues[i]);
+		}
+		free(thread_queues);
+		thread_queues = NULL;
+	}
+	free(immigrants);
+	migration_free(&migration);
+	MPI_Type_free(&MPI_CHROMO);
+	MPI_Type_free(&MPI_STATS);
+	MPI_Op_free(&MPI_MERGE_STATS);
+	//adaptive rates and a resume move these, the next job starts from the base rates
+	mutation_rate = base_mutation_rate;
+	crossover_rate = base_crossover_rate;
+	
+    return status;
+}
+
+
+void free_goal_cache(){
+	//drop every cached goal once no more jobs will run
+	int i;
+	for(i=0; i<goal_cache_count; i++){
+		evaluation_goal_free(&goal_cache[i].goal);
+		free(goal_cache[i].input);
+	}
+	free(goal_cache);
+	goal_cache = NULL;
+	goal_cache_count = 0;
+	cache_goals = 0;
+}
+
+int redirect_stdout(int fd){
+	//send everything printed from here on to fd, returns what restore_stdout needs to undo it
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	return saved;
+}
+
+void restore_stdout(int saved){
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+char* read_manifest(const char* path){
+	//rank 0 reads the whole manifest and every rank gets a copy, NULL if it can't be read
+	long length = -1;
+	char* text = NULL;
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	if(rank == 0){
+		FILE* in = fopen(path, "r");
+		if(in && fseek(in, 0, SEEK_END) == 0 && (length = ftell(in)) >= 0){
+			rewind(in);
+			text = malloc(length + 1);
+			if(fread(text, 1, length, in) != (size_t)length) length = -1;
+		}
+		if(in) fclose(in);
+		if(length < 0) printf("error: could not read manifest %s\n", path);
+	}
+	MPI_Bcast(&length, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+	if(length < 0){
+		free(text);
+		return NULL;
+	}
+	if(rank != 0) text = malloc(length + 1);
+	MPI_Bcast(text, length, MPI_CHAR, 0, MPI_COMM_WORLD);
+	text[length] = '\0';
+	return text;
+}
+
+int split_job(char* line, char** args, int max_args){
+	//break a manifest line into arguments in place, after a program name so it reads like argv
+	int count = 0;
+	char* token;
+	args[count++] = "pgenalg";
+	for(token = strtok(line, " \t\r"); token && count < max_args; token = strtok(NULL, " \t\r")){
+		args[count++] = token;
+	}
+	return count;
+}
+
+int run_manifest(const char* path, int groups){
+	/*
+	
+	Run every job of a manifest, one per line holding the same arguments
+	as the command line, with blank lines and lines starting with # left
+	out. The ranks are split into groups that each run one job at a time,
+	taking the next job off a counter on rank 0 as soon as they finish the
+	last one, so short jobs fill in around long ones. Goals are built once
+	per process and reused by every later job with the same input, and
+	FFTW keeps the wisdom from earlier plans, so planning again is quick.
+	A group's leader sends its job's console output to console.txt in the
+	job's output directory. Returns nonzero if any job failed.
+	
+	*/
+	int world_rank, world_size, njobs = 0;
+	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	char* text = read_manifest(path);
+	if(!text) return 1;
+	
+	//the jobs are the lines with something on them
+	char** jobs = NULL;
+	char* line;
+	for(line = strtok(text, "\n"); line; line = strtok(NULL, "\n")){
+		char* start = line + strspn(line, " \t\r");
+		if(*start == '\0' || *start == '#') continue;
+		jobs = realloc(jobs, (njobs + 1) * sizeof(char*));
+		jobs[njobs++] = start;
+	}
+	if(njobs == 0){
+		if(world_rank == 0) printf("error: manifest %s has no jobs\n", path);
+		free(text);
+		return 1;
+	}
+	if(groups < 1) groups = (njobs < world_size) ? njobs : world_size;
+	if(groups > world_size) groups = world_size;
+	
+	//contiguous runs of ranks, so a group keeps to as few nodes as it can
+	MPI_Comm group;
+	int group_rank, group_size, color = world_rank * groups / world_size;
+	MPI_Comm_split(MPI_COMM_WORLD, color, world_rank, &group);
+	MPI_Comm_rank(group, &group_rank);
+	MPI_Comm_size(group, &group_size);
+	if(world_rank == 0){
+		printf("Manifest %s: %d job(s) on %d group(s) of ranks\n", path, njobs, groups);
+		fflush(stdout);
+	}
+	
+	int next = 0, job, failed = 0, any_failed;
+	MPI_Win counter;
+	MPI_Win_create(&next, (world_rank == 0) ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &counter);
+	cache_goals = 1;
+	while(1){
+		if(group_rank == 0){
+			int one = 1;
+			MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, counter);
+			MPI_Fetch_and_op(&one, &job, MPI_INT, 0, 0, MPI_SUM, counter);
+			MPI_Win_unlock(0, counter);
+		}
+		MPI_Bcast(&job, 1, MPI_INT, 0, group);
+		if(job >= njobs) break;
+		
+		//options keep pointers into the arguments, so they live until the job is done
+		char* copy = strdup(jobs[job]);
+		char* args[256];
+		int nargs = split_job(copy, args, 256);
+		int saved_stdout = -1;
+		double start = MPI_Wtime();
+		if(group_rank == 0){
+			printf("Job %d: ranks %d-%d running %s\n", job + 1, world_rank, world_rank + group_size - 1, jobs[job]);
+			fflush(stdout);
+			if(nargs >= 7){
+				char console[512];
+				snprintf(console, sizeof(console), "%s/console.txt", args[6]);
+				int fd = open(console, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if(fd >= 0){
+					saved_stdout = redirect_stdout(fd);
+					close(fd);
+				}
+			}
+		}
+		int status = run_job(group, nargs, args), job_status;
+		MPI_Reduce(&status, &job_status, 1, MPI_INT, MPI_MAX, 0, group);
+		if(saved_stdout >= 0){
+			restore_stdout(saved_stdout);
+		}
+		if(group_rank == 0){
+			printf("Job %d: %s after %.2f seconds\n", job + 1, job_status ? "failed" : "finished", MPI_Wtime() - start);
+			fflush(stdout);
+			if(job_status) failed = 1;
+		}
+		free(copy);
+	}
+	MPI_Win_free(&counter);
+	MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	
+	free_goal_cache();
+	MPI_Comm_free(&group);
+	free(jobs);
+	free(text);
+	return any_failed;
+}
+
+int read_request(int fd, char* line, int size){
+	//read one line from a client without its line ending, returns 0 if the client hung up first
+	int length = 0;
+	char c;
+	while(read(fd, &c, 1) == 1){
+		if(c == '\n'){
+			line[length] = '\0';
+			return 1;
+		}
+		if(c != '\r' && length < size - 1) line[length++] = c;
+	}
+	return 0;
+}
+
+void idle_bcast(void* buffer, int count, MPI_Datatype type){
+	//a broadcast from rank 0 that sleeps while it waits, so ranks idling between requests leave the cpus alone
+	MPI_Request request;
+	int done = 0;
+	struct timespec nap = {0, 1000000};
+	MPI_Ibcast(buffer, count, type, 0, MPI_COMM_WORLD, &request);
+	MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+	while(!done){
+		nanosleep(&nap, NULL);
+		MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+	}
+}
+
+int serve(const char* path){
+	/*
+	
+	Stay up between runs, taking requests on a Unix socket at path. A
+	client sends one line, either the arguments and options of a run as on
+	the command line or "shutdown". Every rank runs it, and rank 0 sends
+	back what the run prints as it prints it. Each WAV snapshot is followed
+	by a line "wav <bytes> <path>" and exactly that many bytes of the file,
+	and the reply ends with "status <code>", 0 when the run succeeded. A
+	run that fails, even in setup, only fails that request, and the reply
+	names the first rank setup failed on, whose own errors stay in its log.
+	Goals stay cached and FFTW keeps its wisdom between runs, so only the
+	first run with an input pays for reading it and measuring plans.
+	Requests are answered one at a time, in the order they connect.
+	
+	*/
+	int rank, listener = -1, client = -1, length, listening = 1;
+	char line[4096];
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	if(rank == 0){
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+		unlink(path);
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0){
+			printf("error: could not listen on %s\n", path);
+			if(listener >= 0) close(listener);
+			listening = 0;
+		}
+		else{
+			//replies go out a line at a time, and a client hanging up mustn't take the server down
+			setvbuf(stdout, NULL, _IOLBF, 0);
+			signal(SIGPIPE, SIG_IGN);
+			printf("Serving on %s\n", path);
+		}
+	}
+	MPI_Bcast(&listening, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if(!listening) return 1;
+	cache_goals = 1;
+	stream_snapshots = 1;
+	while(1){
+		if(rank == 0){
+			length = 0;
+			while(!length){
+				client = accept(listener, NULL, NULL);
+				if(client < 0) continue;
+				if(read_request(client, line, sizeof(line))) length = strlen(line) + 1;
+				else close(client);
+			}
+		}
+		idle_bcast(&length, 1, MPI_INT);
+		MPI_Bcast(line, length, MPI_CHAR, 0, MPI_COMM_WORLD);
+		if(strcmp(line, "shutdown") == 0) break;
+		
+		char* args[256];
+		int nargs = split_job(line, args, 256);
+		int saved_stdout = (rank == 0) ? redirect_stdout(client) : -1;
+		int status = run_job(MPI_COMM_WORLD, nargs, args), job_status;
+		MPI_Reduce(&status, &job_status, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+		if(rank == 0){
+			restore_stdout(saved_stdout);
+			//rank 0's own errors already went to the client
+			if(failed_rank > 0){
+				dprintf(client, "error: the run could not be set up on rank %d, see its output for why\n", failed_rank);
+			}
+			dprintf(client, "status %d\n", job_status);
+			close(client);
+		}
+	}
+	if(rank == 0){
+		dprintf(client, "status 0\n");
+		close(client);
+		close(listener);
+		unlink(path);
+		printf("Stopped serving on %s\n", path);
+	}
+	stream_snapshots = 0;
+	free_goal_cache();
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	//initialize MPI for K ranks, only the main thread makes MPI calls
+	int mpi_provided, status, i;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &mpi_provided);
+	default_sample_rate = SAMPLE_RATE;
 	
-    
+	const char* manifest = (argc >= 2) ? option_value(argv[1], "--manifest") : NULL;
+	const char* socket_path = (argc >= 2) ? option_value(argv[1], "--serve") : NULL;
+	if(socket_path){
+		status = serve(socket_path);
+	}
+	else if(manifest){
+		int groups = 0;
+		const char* value;
+		for(i=2; i<argc; i++){
+			if((value = option_value(argv[i], "--groups"))) groups = atoi(value);
+		}
+		status = run_manifest(manifest, groups);
+	}
+	else{
+		status = run_job(MPI_COMM_WORLD, argc, argv);
+	}
 	
-    return 0;
+	MPI_Finalize();
+	return status;
 }
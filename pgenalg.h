@@ -1,15 +1,31 @@
+#ifndef H_PGENALG_H
+#define H_PGENALG_H
 #define MAX_GENES 4096
+#define NOTE_BYTES 12
+#include <stdlib.h>
 typedef struct {
 	char genes[MAX_GENES];
 	double fitness;
 	int length;//length of genes
 	
 } chromosome;
+//operator rates and rng state, defined in genetic.c
+extern double mutation_rate;
+extern double crossover_rate;
+extern struct drand48_data drand_buf;
+extern __thread struct drand48_data* rng_state;
 double randv();
+double rate_get(const double* rate);
+void rate_set(double* rate, double value);
 unsigned int randr(unsigned int min, unsigned int max);
 void* evaluate(void* input);
 void* breed(void* input);
+void* prepare_selection(void* input);
+void* initialize_population(void* input);
+void* steady_worker(void* input);
+void copy_chromosome(chromosome* out, const chromosome* in);
 void one_point_crossover(chromosome ch1, chromosome ch2, chromosome* out);
 void mutate(chromosome* chromo);
+chromosome* random_chromosome_from_range(int start, int count);
 chromosome* random_chromosome_from_population();
-chromosome* tournament_selection(int tournament_size);
\ No newline at end of file
+#endif
@@ -0,0 +1,325 @@
+/// placement.c
+//Pinning worker threads to cpus and backing big arrays with huge pages
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <mpi.h>
+#include "placement.h"
+
+#define DEFAULT_HUGE_PAGE (2 * 1024 * 1024)
+
+//Append the cpus of a list like 0,2,4-7 to cpus, returns the new count or -1
+static int parse_cpu_list(const char* text, int* cpus, int count, int max) {
+	while (*text && *text != '\n') {
+		char* end;
+		long first = strtol(text, &end, 10);
+		long last = first;
+		if (end == text || first < 0) return -1;
+		if (*end == '-') {
+			text = end + 1;
+			last = strtol(text, &end, 10);
+			if (end == text || last < first) return -1;
+		}
+		for (; first <= last; ++first) {
+			if (count >= max) return -1;
+			cpus[count++] = (int)first;
+		}
+		text = end;
+		if (*text == ',') ++text;
+		else if (*text && *text != '\n') return -1;
+	}
+	return count;
+}
+
+int placement_parse_policy(const char* name, Placement* placement) {
+	free(placement->list);
+	placement->list = NULL;
+	if (strcmp(name, "none") == 0) placement->policy = PIN_NONE;
+	else if (strcmp(name, "compact") == 0) placement->policy = PIN_COMPACT;
+	else if (strcmp(name, "scatter") == 0) placement->policy = PIN_SCATTER;
+	else if (isdigit((unsigned char)name[0])) {
+		placement->policy = PIN_LIST;
+		placement->list = malloc(CPU_SETSIZE * sizeof(int));
+		placement->list_count = parse_cpu_list(name, placement->list, 0, CPU_SETSIZE);
+		if (placement->list_count <= 0) {
+			free(placement->list);
+			placement->list = NULL;
+			return 0;
+		}
+	}
+	else return 0;
+	return 1;
+}
+
+int placement_parse_hugepages(const char* name, HugePages* hugepages) {
+	if (strcmp(name, "off") == 0) *hugepages = HUGEPAGES_OFF;
+	else if (strcmp(name, "thp") == 0) *hugepages = HUGEPAGES_THP;
+	else if (strcmp(name, "explicit") == 0) *hugepages = HUGEPAGES_EXPLICIT;
+	else return 0;
+	return 1;
+}
+
+const char* placement_policy_name(PinPolicy policy) {
+	if (policy == PIN_COMPACT) return "compact";
+	if (policy == PIN_SCATTER) return "scatter";
+	if (policy == PIN_LIST) return "cpu list";
+	return "none";
+}
+
+const char* placement_hugepages_name(HugePages hugepages) {
+	if (hugepages == HUGEPAGES_THP) return "thp";
+	if (hugepages == HUGEPAGES_EXPLICIT) return "explicit";
+	return "off";
+}
+
+//NUMA node of every cpu from sysfs, everything is node 0 where there is no NUMA information
+static void read_nodes(int* node_of) {
+	int i, count, cpus[CPU_SETSIZE];
+	memset(node_of, 0, CPU_SETSIZE * sizeof(int));
+	DIR* nodes = opendir("/sys/devices/system/node");
+	if (!nodes) return;
+	struct dirent* entry;
+	while ((entry = readdir(nodes))) {
+		int node;
+		char path[512], list[4096];
+		if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+		FILE* file = fopen(path, "r");
+		if (!file) continue;
+		if (fgets(list, sizeof(list), file) && (count = parse_cpu_list(list, cpus, 0, CPU_SETSIZE)) > 0) {
+			for (i = 0; i < count; ++i) {
+				if (cpus[i] < CPU_SETSIZE) node_of[cpus[i]] = node;
+			}
+		}
+		fclose(file);
+	}
+	closedir(nodes);
+}
+
+static size_t read_huge_page_size() {
+	char line[256];
+	size_t kb = 0;
+	FILE* file = fopen("/proc/meminfo", "r");
+	if (!file) return DEFAULT_HUGE_PAGE;
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) break;
+	}
+	fclose(file);
+	return kb ? kb * 1024 : DEFAULT_HUGE_PAGE;
+}
+
+//Order the usable cpus for the policy, returns how many there are
+static int order_cpus(const Placement* placement, const cpu_set_t* allowed, int* order) {
+	int node_of[CPU_SETSIZE];
+	int i, n = 0;
+	if (placement->policy == PIN_LIST) {
+		for (i = 0; i < placement->list_count; ++i) {
+			if (placement->list[i] >= CPU_SETSIZE || !CPU_ISSET(placement->list[i], allowed)) {
+				printf("error: cpu %d in --pin is not available to this rank\n", placement->list[i]);
+				return 0;
+			}
+			order[n++] = placement->list[i];
+		}
+		return n;
+	}
+	read_nodes(node_of);
+	int max_node = 0;
+	for (i = 0; i < CPU_SETSIZE; ++i) {
+		if (CPU_ISSET(i, allowed) && node_of[i] > max_node) max_node = node_of[i];
+	}
+	if (placement->policy == PIN_COMPACT) {
+		//node by node, cpus in order within each
+		int node;
+		for (node = 0; node <= max_node; ++node) {
+			for (i = 0; i < CPU_SETSIZE; ++i) {
+				if (CPU_ISSET(i, allowed) && node_of[i] == node) order[n++] = i;
+			}
+		}
+		return n;
+	}
+	//scatter, the k-th cpu of every node before the (k+1)-th of any
+	int* next = calloc(max_node + 1, sizeof(int));
+	int total = CPU_COUNT(allowed);
+	while (n < total) {
+		int node;
+		for (node = 0; node <= max_node; ++node) {
+			for (i = next[node]; i < CPU_SETSIZE; ++i) {
+				if (CPU_ISSET(i, allowed) && node_of[i] == node) break;
+			}
+			next[node] = i + 1;
+			if (i < CPU_SETSIZE) order[n++] = i;
+		}
+	}
+	free(next);
+	return n;
+}
+
+/*
+
+Collective over comm. Ranks of comm on the same node with the same cpu
+set (the launcher didn't bind them) offset into the cpu order by the
+threads of the ranks before them, while ranks the launcher already bound
+to separate cpus each start from the beginning of their own set.
+
+*/
+int placement_initialize(Placement* placement, int threads, MPI_Comm comm) {
+	int i;
+	placement->threads = threads;
+	placement->comm = comm;
+	placement->huge_page = read_huge_page_size();
+	placement->huge_fallbacks = 0;
+	placement->attrs = NULL;
+	placement->cpus = malloc(threads * sizeof(int));
+	placement->seen_cpu = malloc(threads * sizeof(int));
+	placement->seen_node = malloc(threads * sizeof(int));
+	for (i = 0; i < threads; ++i) {
+		placement->cpus[i] = -1;
+		placement->seen_cpu[i] = -1;
+		placement->seen_node[i] = -1;
+	}
+	if (placement->policy == PIN_NONE) return 1;
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	MPI_Comm local;
+	int local_rank, local_size;
+	MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &local);
+	MPI_Comm_rank(local, &local_rank);
+	MPI_Comm_size(local, &local_size);
+	cpu_set_t* sets = malloc(local_size * sizeof(cpu_set_t));
+	MPI_Allgather(&allowed, sizeof(cpu_set_t), MPI_BYTE, sets, sizeof(cpu_set_t), MPI_BYTE, local);
+	int offset = 0;
+	for (i = 0; i < local_rank; ++i) {
+		if (CPU_EQUAL(&sets[i], &allowed)) offset += threads;
+	}
+	free(sets);
+	MPI_Comm_free(&local);
+
+	int order[CPU_SETSIZE];
+	int count = order_cpus(placement, &allowed, order);
+	if (count == 0) return 0;
+	placement->attrs = malloc(threads * sizeof(pthread_attr_t));
+	for (i = 0; i < threads; ++i) {
+		cpu_set_t cpu;
+		placement->cpus[i] = order[(offset + i) % count];
+		CPU_ZERO(&cpu);
+		CPU_SET(placement->cpus[i], &cpu);
+		pthread_attr_init(&placement->attrs[i]);
+		pthread_attr_setaffinity_np(&placement->attrs[i], sizeof(cpu), &cpu);
+	}
+	return 1;
+}
+
+//Creation attributes for a worker, or NULL when threads aren't pinned
+pthread_attr_t* placement_attr(Placement* placement, int thread) {
+	return placement->attrs ? &placement->attrs[thread] : NULL;
+}
+
+static size_t mapped_bytes(const Placement* placement, size_t bytes) {
+	return (bytes + placement->huge_page - 1) / placement->huge_page * placement->huge_page;
+}
+
+/*
+
+Allocate an array that the caller's thread should touch first. Without
+huge pages this is plain malloc. Otherwise the mapping is rounded up to
+whole huge pages, and an empty hugetlbfs pool falls back to THP.
+
+*/
+void* placement_alloc(Placement* placement, size_t bytes) {
+	if (placement->hugepages == HUGEPAGES_OFF) return malloc(bytes);
+	size_t length = mapped_bytes(placement, bytes);
+	void* memory = MAP_FAILED;
+	if (placement->hugepages == HUGEPAGES_EXPLICIT) {
+		memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory == MAP_FAILED) __sync_fetch_and_add(&placement->huge_fallbacks, 1);
+	}
+	if (memory == MAP_FAILED) {
+		memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) return NULL;
+		madvise(memory, length, MADV_HUGEPAGE);
+	}
+	return memory;
+}
+
+void placement_release(const Placement* placement, void* memory, size_t bytes) {
+	if (!memory) return;
+	if (placement->hugepages == HUGEPAGES_OFF) free(memory);
+	else munmap(memory, mapped_bytes(placement, bytes));
+}
+
+//Called by a worker to note which cpu and node it actually ran on
+void placement_record(Placement* placement, int thread) {
+	unsigned int cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+		placement->seen_cpu[thread] = cpu;
+		placement->seen_node[thread] = node;
+	}
+}
+
+//Collective over the placement's comm, its rank 0 prints where every thread of every rank was placed
+void placement_report(const Placement* placement) {
+	int rank, ranks, i, j, fallbacks = 0;
+	MPI_Comm_rank(placement->comm, &rank);
+	MPI_Comm_size(placement->comm, &ranks);
+	int threads = placement->threads;
+	int* mine = malloc(3 * threads * sizeof(int));
+	for (i = 0; i < threads; ++i) {
+		mine[3 * i] = placement->cpus[i];
+		mine[3 * i + 1] = placement->seen_cpu[i];
+		mine[3 * i + 2] = placement->seen_node[i];
+	}
+	char host[MPI_MAX_PROCESSOR_NAME];
+	int length;
+	memset(host, 0, sizeof(host));
+	MPI_Get_processor_name(host, &length);
+	int* all = (rank == 0) ? malloc(3 * threads * ranks * sizeof(int)) : NULL;
+	char* hosts = (rank == 0) ? malloc(MPI_MAX_PROCESSOR_NAME * ranks) : NULL;
+	MPI_Gather(mine, 3 * threads, MPI_INT, all, 3 * threads, MPI_INT, 0, placement->comm);
+	MPI_Gather(host, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, hosts, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, placement->comm);
+	MPI_Reduce((void*)&placement->huge_fallbacks, &fallbacks, 1, MPI_INT, MPI_SUM, 0, placement->comm);
+	if (rank == 0) {
+		printf("Placement: %s pinning, huge pages %s\n", placement_policy_name(placement->policy),
+			placement_hugepages_name(placement->hugepages));
+		for (i = 0; i < ranks; ++i) {
+			printf("\trank %d on %s:", i, hosts + i * MPI_MAX_PROCESSOR_NAME);
+			for (j = 0; j < threads; ++j) {
+				int* thread = all + 3 * (i * threads + j);
+				if (thread[0] < 0) printf(" thread %d unpinned (cpu %d node %d)", j, thread[1], thread[2]);
+				else printf(" thread %d cpu %d (node %d)", j, thread[1], thread[2]);
+			}
+			printf("\n");
+		}
+		if (fallbacks > 0) {
+			printf("warning: %d explicit huge page allocation(s) used transparent huge pages instead\n", fallbacks);
+		}
+		free(all);
+		free(hosts);
+	}
+	free(mine);
+}
+
+//Release everything, leaving the placement back at no pinning and no huge pages
+void placement_free(Placement* placement) {
+	int i;
+	if (placement->attrs) {
+		for (i = 0; i < placement->threads; ++i) {
+			pthread_attr_destroy(&placement->attrs[i]);
+		}
+		free(placement->attrs);
+	}
+	free(placement->list);
+	free(placement->cpus);
+	free(placement->seen_cpu);
+	free(placement->seen_node);
+	memset(placement, 0, sizeof(Placement));
+}
@@ -0,0 +1,57 @@
+#ifndef H_PLACEMENT_H
+#define H_PLACEMENT_H
+#include <stddef.h>
+#include <pthread.h>
+#include <mpi.h>
+
+//Where each worker thread runs
+typedef enum {
+	PIN_NONE, //leave it to the scheduler
+	PIN_COMPACT, //fill one NUMA node's cores before moving to the next
+	PIN_SCATTER, //deal threads round-robin over the NUMA nodes
+	PIN_LIST //cpus given on the command line, in order
+} PinPolicy;
+
+//What backs the big arrays
+typedef enum {
+	HUGEPAGES_OFF,
+	HUGEPAGES_THP, //transparent huge pages, asked for with madvise
+	HUGEPAGES_EXPLICIT //the hugetlbfs pool, falling back to THP when it is empty
+} HugePages;
+
+/*
+
+Thread pinning and memory placement for one rank. Threads are pinned
+through their creation attributes, so every run_threads lands each worker
+on the same cpu, and a buffer first touched by its worker stays on that
+worker's NUMA node. Ranks sharing a node and a cpu set take consecutive
+runs of cpus so they don't pin on top of each other.
+
+*/
+typedef struct {
+	PinPolicy policy;
+	HugePages hugepages;
+	int* list; //cpus for PIN_LIST
+	int list_count;
+	int threads;
+	MPI_Comm comm; //the ranks placed together, reported together
+	int* cpus; //cpu each thread is pinned to, or -1
+	int* seen_cpu; //where each thread found itself when it touched its buffers
+	int* seen_node;
+	pthread_attr_t* attrs;
+	size_t huge_page; //bytes, explicit allocations are rounded up to this
+	int huge_fallbacks; //explicit allocations that had to use THP
+} Placement;
+
+int placement_parse_policy(const char* name, Placement* placement);
+int placement_parse_hugepages(const char* name, HugePages* hugepages);
+const char* placement_policy_name(PinPolicy policy);
+const char* placement_hugepages_name(HugePages hugepages);
+int placement_initialize(Placement* placement, int threads, MPI_Comm comm);
+pthread_attr_t* placement_attr(Placement* placement, int thread);
+void* placement_alloc(Placement* placement, size_t bytes);
+void placement_release(const Placement* placement, void* memory, size_t bytes);
+void placement_record(Placement* placement, int thread);
+void placement_report(const Placement* placement);
+void placement_free(Placement* placement);
+#endif
@@ -0,0 +1,42 @@
+/// queue.c
+//Single producer, single consumer ring buffer for moving chromosomes between threads
+#include <stdio.h>
+#include <stdlib.h>
+#include "queue.h"
+
+int queue_initialize(ChromosomeQueue* queue, unsigned int capacity) {
+	queue->capacity = 1;
+	while (queue->capacity < capacity) queue->capacity <<= 1;
+	queue->slots = malloc(queue->capacity * sizeof(chromosome));
+	queue->head = 0;
+	queue->tail = 0;
+	if (!queue->slots) {
+		printf("error: could not allocate chromosome queue\n");
+		return 0;
+	}
+	return 1;
+}
+
+void queue_free(ChromosomeQueue* queue) {
+	free(queue->slots);
+}
+
+//Copy a chromosome in, returns 0 if the queue is full
+int queue_push(ChromosomeQueue* queue, const chromosome* chromo) {
+	unsigned int tail = queue->tail;
+	unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	if (tail - head == queue->capacity) return 0;
+	copy_chromosome(&queue->slots[tail & (queue->capacity - 1)], chromo);
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+//Copy the oldest chromosome out, returns 0 if the queue is empty
+int queue_pop(ChromosomeQueue* queue, chromosome* chromo) {
+	unsigned int head = queue->head;
+	unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+	if (head == tail) return 0;
+	copy_chromosome(chromo, &queue->slots[head & (queue->capacity - 1)]);
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
@@ -0,0 +1,17 @@
+#ifndef H_QUEUE_H
+#define H_QUEUE_H
+#include "pgenalg.h"
+
+//Lock-free queue of chromosomes with exactly one producer and one consumer thread
+typedef struct {
+	chromosome* slots;
+	unsigned int capacity; //power of two
+	unsigned int head; //next slot to read, only written by the consumer
+	unsigned int tail; //next slot to write, only written by the producer
+} ChromosomeQueue;
+
+int queue_initialize(ChromosomeQueue* queue, unsigned int capacity);
+void queue_free(ChromosomeQueue* queue);
+int queue_push(ChromosomeQueue* queue, const chromosome* chromo);
+int queue_pop(ChromosomeQueue* queue, chromosome* chromo);
+#endif
@@ -0,0 +1,302 @@
+/// selection.c
+//Parent selection from a compact copy of the population's fitness
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "pgenalg.h"
+#include "selection.h"
+
+typedef struct {
+	double fitness;
+	int index;
+} RankEntry;
+
+int selection_parse_scheme(const char* name, SelectionScheme* scheme) {
+	if (strcmp(name, "tournament") == 0) *scheme = SELECT_TOURNAMENT;
+	else if (strcmp(name, "rank") == 0) *scheme = SELECT_RANK;
+	else if (strcmp(name, "roulette") == 0) *scheme = SELECT_ROULETTE;
+	else return 0;
+	return 1;
+}
+
+const char* selection_scheme_name(SelectionScheme scheme) {
+	if (scheme == SELECT_RANK) return "rank";
+	if (scheme == SELECT_ROULETTE) return "roulette";
+	return "tournament";
+}
+
+int selector_initialize(Selector* selector, SelectionScheme scheme, int tournament_size, int count, int slices) {
+	memset(selector, 0, sizeof(Selector));
+	selector->scheme = scheme;
+	selector->tournament_size = (tournament_size < 1) ? 1 : tournament_size;
+	selector->count = count;
+	selector->slices = slices;
+	selector->fitness = calloc(count, sizeof(double));
+	selector->order = malloc(count * sizeof(int));
+	selector->slice_order = malloc(count * sizeof(int));
+	selector->entries = malloc(count * sizeof(RankEntry));
+	selector->work = malloc(count * sizeof(int));
+	selector->probability = malloc(count * sizeof(double));
+	selector->alias = malloc(count * sizeof(int));
+	selector->slice_start = calloc(slices, sizeof(int));
+	selector->slice_count = calloc(slices, sizeof(int));
+	selector->slice_weight = calloc(slices, sizeof(double));
+	selector->top_probability = malloc(slices * sizeof(double));
+	selector->top_alias = malloc(slices * sizeof(int));
+	selector->top_slice = malloc(slices * sizeof(int));
+	selector->top_weight = malloc(slices * sizeof(double));
+	if (!selector->fitness || !selector->order || !selector->slice_order || !selector->entries
+		|| !selector->work || !selector->probability || !selector->alias || !selector->slice_start
+		|| !selector->slice_count || !selector->slice_weight || !selector->top_probability || !selector->top_alias
+		|| !selector->top_slice || !selector->top_weight) {
+		printf("error: could not allocate selection tables\n");
+		return 0;
+	}
+	return 1;
+}
+
+void selector_free(Selector* selector) {
+	free(selector->fitness);
+	free(selector->order);
+	free(selector->slice_order);
+	free(selector->entries);
+	free(selector->work);
+	free(selector->probability);
+	free(selector->alias);
+	free(selector->slice_start);
+	free(selector->slice_count);
+	free(selector->slice_weight);
+	free(selector->top_probability);
+	free(selector->top_alias);
+	free(selector->top_slice);
+	free(selector->top_weight);
+}
+
+static int compare_entries(const void* a, const void* b) {
+	double fa = ((const RankEntry*)a)->fitness;
+	double fb = ((const RankEntry*)b)->fitness;
+	return (fa > fb) - (fa < fb);
+}
+
+//Roulette weight of a member, kept finite so the totals don't overflow
+static double roulette_weight(const Selector* selector, double fitness) {
+	if (fitness <= 0) return 0;
+	return fmin(fitness, DBL_MAX / (selector->count + 1));
+}
+
+//Vose's alias method over weights[0, count), work needs count ints
+static double build_alias(const double* weights, int count, double* probability, int* alias, int* work) {
+	double total = 0;
+	int i;
+	for (i = 0; i < count; ++i) total += weights[i];
+	if (count == 0) return 0;
+	if (total <= 0) {
+		//no information, draw uniformly
+		for (i = 0; i < count; ++i) {
+			probability[i] = 1;
+			alias[i] = i;
+		}
+		return 0;
+	}
+	//small indices stack up from the front of work, large ones from the back
+	int small = 0, large = count;
+	for (i = 0; i < count; ++i) {
+		probability[i] = weights[i] * count / total;
+		if (probability[i] < 1) work[small++] = i;
+		else work[--large] = i;
+	}
+	while (small > 0 && large < count) {
+		int less = work[--small];
+		int more = work[large];
+		alias[less] = more;
+		probability[more] = (probability[more] + probability[less]) - 1;
+		if (probability[more] < 1) {
+			//the large entry became small, the slot we just popped has room for it
+			++large;
+			work[small++] = more;
+		}
+	}
+	while (large < count) {
+		int index = work[large++];
+		probability[index] = 1;
+		alias[index] = index;
+	}
+	while (small > 0) {
+		int index = work[--small];
+		probability[index] = 1;
+		alias[index] = index;
+	}
+	return total;
+}
+
+//Called by each thread for its own slice once its fitness values are written
+void selector_build_slice(Selector* selector, int slice, int start, int count) {
+	int i;
+	selector->slice_start[slice] = start;
+	selector->slice_count[slice] = count;
+	if (count <= 0) {
+		selector->slice_weight[slice] = 0;
+		return;
+	}
+
+	if (selector->scheme == SELECT_RANK) {
+		RankEntry* entries = (RankEntry*)selector->entries + start;
+		for (i = 0; i < count; ++i) {
+			entries[i].fitness = selector->fitness[start + i];
+			entries[i].index = start + i;
+		}
+		qsort(entries, count, sizeof(RankEntry), compare_entries);
+		for (i = 0; i < count; ++i) {
+			selector->slice_order[start + i] = entries[i].index;
+		}
+	} else if (selector->scheme == SELECT_ROULETTE) {
+		//alias table entries are relative to the slice start
+		double* weights = (double*)((RankEntry*)selector->entries + start);
+		for (i = 0; i < count; ++i) {
+			weights[i] = roulette_weight(selector, selector->fitness[start + i]);
+		}
+		selector->slice_weight[slice] = build_alias(weights, count,
+			selector->probability + start, selector->alias + start, selector->work + start);
+	}
+}
+
+//Rounds of selector_merge needed to join every slice's rank order, 0 unless ranking
+int selector_merge_rounds(const Selector* selector) {
+	int rounds = 0, width = 1;
+	if (selector->scheme != SELECT_RANK) return 0;
+	while (width < selector->slices) {
+		width *= 2;
+		++rounds;
+	}
+	return rounds;
+}
+
+/*
+
+Rank orders are joined pairwise, each round halving the number of sorted
+runs: in round r, slice s merges runs [s, s + 2^r) and [s + 2^r, s + 2^(r+1))
+when s is a multiple of 2^(r+1). Rounds alternate between order and work
+so the last one lands in order, and ties go to the lower slice as in a
+serial merge. Every thread calls it for its own slice, with a barrier
+between rounds.
+
+*/
+void selector_merge(Selector* selector, int slice, int round) {
+	int rounds = selector_merge_rounds(selector);
+	int width = 1 << round;
+	if (slice % (2 * width) != 0) return;
+	const int* in = (round == 0) ? selector->slice_order : (((rounds - round) % 2 == 0) ? selector->order : selector->work);
+	int* out = ((rounds - round) % 2 == 1) ? selector->order : selector->work;
+	int middle = slice + width, end = slice + 2 * width;
+	if (middle > selector->slices) middle = selector->slices;
+	if (end > selector->slices) end = selector->slices;
+	int left = selector->slice_start[slice];
+	int left_end = selector->slice_start[middle - 1] + selector->slice_count[middle - 1];
+	int right = left_end;
+	int right_end = selector->slice_start[end - 1] + selector->slice_count[end - 1];
+	int i = left;
+	while (left < left_end && right < right_end) {
+		if (selector->fitness[in[right]] < selector->fitness[in[left]]) out[i++] = in[right++];
+		else out[i++] = in[left++];
+	}
+	while (left < left_end) out[i++] = in[left++];
+	while (right < right_end) out[i++] = in[right++];
+}
+
+//Join the slices once every thread has built its own, merged says the threads already ran selector_merge
+void selector_finish(Selector* selector, int merged) {
+	int i;
+	if (selector->scheme == SELECT_RANK && !merged) {
+		//merge the sorted slices, there are only as many as threads
+		int* heads = calloc(selector->slices, sizeof(int));
+		for (i = 0; i < selector->count; ++i) {
+			int best = -1, j;
+			for (j = 0; j < selector->slices; ++j) {
+				if (heads[j] >= selector->slice_count[j]) continue;
+				int index = selector->slice_order[selector->slice_start[j] + heads[j]];
+				if (best < 0 || selector->fitness[index] < selector->fitness[selector->order[i]]) {
+					best = j;
+					selector->order[i] = index;
+				}
+			}
+			heads[best]++;
+		}
+		free(heads);
+	} else if (selector->scheme == SELECT_RANK && selector_merge_rounds(selector) == 0) {
+		//a single slice is already in order
+		memcpy(selector->order, selector->slice_order, selector->count * sizeof(int));
+	} else if (selector->scheme == SELECT_ROULETTE) {
+		//an empty slice has nothing to draw, so it is left out of the table altogether
+		int* work = malloc(selector->slices * sizeof(int));
+		selector->top_count = 0;
+		for (i = 0; i < selector->slices; ++i) {
+			if (selector->slice_count[i] <= 0) continue;
+			selector->top_slice[selector->top_count] = i;
+			selector->top_weight[selector->top_count++] = selector->slice_weight[i];
+		}
+		build_alias(selector->top_weight, selector->top_count, selector->top_probability, selector->top_alias, work);
+		free(work);
+	}
+}
+
+//Record a member that changed after the tables were built, tournaments see it right away,
+//rank and roulette once its slice is built again and the slices joined
+void selector_update(Selector* selector, int index, double fitness) {
+	selector->fitness[index] = fitness;
+}
+
+static int uniform_index(int count) {
+	int index = (int)(randv() * count);
+	return (index < count) ? index : (count - 1);
+}
+
+//Best of tournament_size + 1 uniform draws from [start, start + count)
+static int draw_tournament(const Selector* selector, int start, int count) {
+	int best = start + uniform_index(count);
+	int i;
+	for (i = 0; i < selector->tournament_size; ++i) {
+		int index = start + uniform_index(count);
+		if (selector->fitness[index] > selector->fitness[best]) best = index;
+	}
+	return best;
+}
+
+//Rank r (0 is the worst) has weight r + 1, invert the triangular CDF directly
+static int draw_rank(const int* order, int count) {
+	double x = randv() * count * (count + 1.0) / 2.0;
+	int r = (int)((sqrt(1.0 + 8.0 * x) - 1.0) / 2.0);
+	if (r >= count) r = count - 1;
+	return order[r];
+}
+
+static int draw_alias(const double* probability, const int* alias, int count) {
+	int index = uniform_index(count);
+	return (randv() < probability[index]) ? index : alias[index];
+}
+
+//Draw a parent from the whole population, returns its index
+int selector_draw(const Selector* selector) {
+	if (selector->scheme == SELECT_RANK) {
+		return draw_rank(selector->order, selector->count);
+	}
+	if (selector->scheme == SELECT_ROULETTE) {
+		int slice = selector->top_slice[draw_alias(selector->top_probability, selector->top_alias, selector->top_count)];
+		return selector_draw_slice(selector, slice);
+	}
+	return draw_tournament(selector, 0, selector->count);
+}
+
+//Draw a parent from one thread's slice, returns its index
+int selector_draw_slice(const Selector* selector, int slice) {
+	int start = selector->slice_start[slice];
+	int count = selector->slice_count[slice];
+	if (selector->scheme == SELECT_RANK) {
+		return draw_rank(selector->slice_order + start, count);
+	}
+	if (selector->scheme == SELECT_ROULETTE) {
+		return start + draw_alias(selector->probability + start, selector->alias + start, count);
+	}
+	return draw_tournament(selector, start, count);
+}
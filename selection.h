@@ -0,0 +1,53 @@
+#ifndef H_SELECTION_H
+#define H_SELECTION_H
+
+//How parents are drawn from the population
+typedef enum {
+	SELECT_TOURNAMENT, //best of k uniform draws
+	SELECT_RANK, //linear ranking, the best member is n times as likely as the worst
+	SELECT_ROULETTE //proportional to fitness
+} SelectionScheme;
+
+/*
+
+Compact view of the population used to draw parents. After evaluation
+every thread writes the fitness of its slice into a flat array and builds
+that slice's sorted order and alias table, the threads merge the rank
+orders pairwise, then selector_finish joins the rest. Draws only touch
+these arrays, never the chromosomes themselves.
+
+*/
+typedef struct {
+	SelectionScheme scheme;
+	int tournament_size;
+	int count; //population size
+	int slices; //one per thread
+	double* fitness; //fitness of every member
+	int* order; //member indices by increasing fitness across the population
+	int* slice_order; //member indices by increasing fitness within each slice
+	void* entries; //scratch for sorting
+	int* work; //scratch for building alias tables
+	double* probability; //alias table, stored per slice
+	int* alias;
+	int* slice_start;
+	int* slice_count;
+	double* slice_weight; //total roulette weight of each slice
+	double* top_probability; //alias table choosing a slice, over the non-empty ones only
+	int* top_alias;
+	int* top_slice; //slice of each entry of the top table
+	double* top_weight; //scratch for building the top table
+	int top_count;
+} Selector;
+
+int selection_parse_scheme(const char* name, SelectionScheme* scheme);
+const char* selection_scheme_name(SelectionScheme scheme);
+int selector_initialize(Selector* selector, SelectionScheme scheme, int tournament_size, int count, int slices);
+void selector_free(Selector* selector);
+void selector_build_slice(Selector* selector, int slice, int start, int count);
+int selector_merge_rounds(const Selector* selector);
+void selector_merge(Selector* selector, int slice, int round);
+void selector_finish(Selector* selector, int merged);
+void selector_update(Selector* selector, int index, double fitness);
+int selector_draw(const Selector* selector);
+int selector_draw_slice(const Selector* selector, int slice);
+#endif
@@ -0,0 +1,83 @@
+/// stats.c
+//Population statistics gathered during evaluation
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "pgenalg.h"
+#include "stats.h"
+
+void stats_reset(PopulationStats* stats) {
+	memset(stats, 0, sizeof(PopulationStats));
+	stats->best = -1;
+	stats->best_index = -1;
+	stats->worst = DBL_MAX;
+}
+
+//Add one chromosome, using Welford's update for the mean and variance
+void stats_add(PopulationStats* stats, double fitness, int length, int index) {
+	stats->count += 1;
+	if (fitness > stats->best) {
+		stats->best = fitness;
+		stats->best_index = index;
+	}
+	if (fitness < stats->worst) stats->worst = fitness;
+	double delta = fitness - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (fitness - stats->mean);
+	stats->notes += length / NOTE_BYTES;
+	stats->length += length;
+	int bin = length * LENGTH_BINS / MAX_GENES;
+	if (bin >= LENGTH_BINS) bin = LENGTH_BINS - 1;
+	if (bin < 0) bin = 0;
+	stats->length_histogram[bin] += 1;
+}
+
+//Combine two summaries, best_index follows whichever side had the best member
+void stats_merge(PopulationStats* into, const PopulationStats* from) {
+	int i;
+	if (from->count == 0) return;
+	if (into->count == 0) {
+		*into = *from;
+		return;
+	}
+	long long count = into->count + from->count;
+	double delta = from->mean - into->mean;
+	into->m2 += from->m2 + delta * delta * ((double)into->count * from->count / count);
+	into->mean += delta * from->count / count;
+	into->count = count;
+	if (from->best > into->best) {
+		into->best = from->best;
+		into->best_index = from->best_index;
+	}
+	if (from->worst < into->worst) into->worst = from->worst;
+	into->notes += from->notes;
+	into->length += from->length;
+	for (i = 0; i < LENGTH_BINS; ++i) {
+		into->length_histogram[i] += from->length_histogram[i];
+	}
+}
+
+double stats_variance(const PopulationStats* stats) {
+	return (stats->count > 1) ? (stats->m2 / (stats->count - 1)) : 0;
+}
+
+double stats_mean_notes(const PopulationStats* stats) {
+	return (stats->count > 0) ? ((double)stats->notes / stats->count) : 0;
+}
+
+double stats_mean_length(const PopulationStats* stats) {
+	return (stats->count > 0) ? ((double)stats->length / stats->count) : 0;
+}
+
+//Entropy of the length histogram, 0 when every genome is the same size and 1 when spread evenly
+double stats_diversity(const PopulationStats* stats) {
+	double entropy = 0;
+	int i;
+	if (stats->count == 0) return 0;
+	for (i = 0; i < LENGTH_BINS; ++i) {
+		if (stats->length_histogram[i] == 0) continue;
+		double p = (double)stats->length_histogram[i] / stats->count;
+		entropy -= p * log(p);
+	}
+	return entropy / log(LENGTH_BINS);
+}
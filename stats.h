@@ -0,0 +1,26 @@
+#ifndef H_STATS_H
+#define H_STATS_H
+
+#define LENGTH_BINS 16
+
+//Running summary of a population, built up one chromosome at a time and merged between threads
+typedef struct {
+	long long count;
+	double best;
+	int best_index; //index of the best member on the rank that owns it
+	double worst;
+	double mean; //fitness mean and sum of squared deviations, merged pairwise
+	double m2;
+	long long notes;
+	long long length;
+	long long length_histogram[LENGTH_BINS]; //genome length in bytes, MAX_GENES / LENGTH_BINS per bin
+} PopulationStats;
+
+void stats_reset(PopulationStats* stats);
+void stats_add(PopulationStats* stats, double fitness, int length, int index);
+void stats_merge(PopulationStats* into, const PopulationStats* from);
+double stats_variance(const PopulationStats* stats);
+double stats_mean_notes(const PopulationStats* stats);
+double stats_mean_length(const PopulationStats* stats);
+double stats_diversity(const PopulationStats* stats);
+#endif
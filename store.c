@@ -0,0 +1,140 @@
+/// store.c
+//Memory-mapped population storage with a RAM cache of the elites
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "store.h"
+
+//Create and map the backing file, which is unlinked at once so it goes away with the process
+int store_initialize(PopulationStore* store, const char* path, int count) {
+	memset(store, 0, sizeof(PopulationStore));
+	store->count = count;
+	store->bytes = 2 * (size_t)count * sizeof(chromosome);
+	store->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (store->fd < 0) {
+		printf("error: could not create population store %s\n", path);
+		return 0;
+	}
+	unlink(path);
+	if (ftruncate(store->fd, store->bytes) != 0) {
+		printf("error: could not size population store %s\n", path);
+		close(store->fd);
+		return 0;
+	}
+	store->base = mmap(NULL, store->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (store->base == MAP_FAILED) {
+		printf("error: could not map population store %s\n", path);
+		store->base = NULL;
+		close(store->fd);
+		return 0;
+	}
+	return 1;
+}
+
+//First or second population in the store
+chromosome* store_population(const PopulationStore* store, int which) {
+	return store->base + (size_t)which * store->count;
+}
+
+//Ask the kernel to start reading in a run of slots we are about to use
+void store_prefetch(const PopulationStore* store, const chromosome* first, int count) {
+	long page = sysconf(_SC_PAGESIZE);
+	if (count <= 0) return;
+	uintptr_t start = (uintptr_t)first & ~(uintptr_t)(page - 1);
+	uintptr_t end = (uintptr_t)(first + count);
+	//only the mapping is worth advising, callers may also pass heap buffers
+	if ((uintptr_t)first < (uintptr_t)store->base || end > (uintptr_t)store->base + store->bytes) return;
+	madvise((void*)start, end - start, MADV_WILLNEED);
+}
+
+void store_free(PopulationStore* store) {
+	if (!store->base) return;
+	munmap(store->base, store->bytes);
+	close(store->fd);
+	store->base = NULL;
+}
+
+int elite_initialize(EliteCache* cache, int size, int count) {
+	int i;
+	memset(cache, 0, sizeof(EliteCache));
+	if (size > count) size = count;
+	cache->size = size;
+	cache->count = count;
+	cache->members = malloc(size * sizeof(chromosome));
+	cache->indices = malloc(size * sizeof(int));
+	cache->slot = malloc(count * sizeof(int));
+	if ((size > 0 && (!cache->members || !cache->indices)) || !cache->slot) {
+		printf("error: could not allocate elite cache\n");
+		return 0;
+	}
+	for (i = 0; i < count; ++i) {
+		cache->slot[i] = -1;
+	}
+	return 1;
+}
+
+//Restore the min-heap on fitness below position i
+static void sift_down(int* heap, int used, const double* fitness, int i) {
+	while (1) {
+		int smallest = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+		if (left < used && fitness[heap[left]] < fitness[heap[smallest]]) smallest = left;
+		if (right < used && fitness[heap[right]] < fitness[heap[smallest]]) smallest = right;
+		if (smallest == i) return;
+		int swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+//Copy the size fittest members into the cache, keeping a min-heap of the best seen so far
+void elite_fill(EliteCache* cache, const chromosome* population, const double* fitness) {
+	int i;
+	for (i = 0; i < cache->used; ++i) {
+		cache->slot[cache->indices[i]] = -1;
+	}
+	cache->used = 0;
+	if (cache->size == 0) return;
+	for (i = 0; i < cache->count; ++i) {
+		if (cache->used < cache->size) {
+			cache->indices[cache->used++] = i;
+			if (cache->used == cache->size) {
+				int j;
+				for (j = cache->size / 2 - 1; j >= 0; --j) {
+					sift_down(cache->indices, cache->used, fitness, j);
+				}
+			}
+		} else if (fitness[i] > fitness[cache->indices[0]]) {
+			cache->indices[0] = i;
+			sift_down(cache->indices, cache->used, fitness, 0);
+		}
+	}
+	for (i = 0; i < cache->used; ++i) {
+		copy_chromosome(&cache->members[i], &population[cache->indices[i]]);
+		cache->slot[cache->indices[i]] = i;
+	}
+}
+
+//A member, from the cache when it holds it
+const chromosome* elite_lookup(const EliteCache* cache, const chromosome* population, int index) {
+	int slot = cache->slot[index];
+	return (slot >= 0) ? &cache->members[slot] : &population[index];
+}
+
+//Drop a member from the cache once its slot is overwritten, until the next elite_fill
+void elite_forget(EliteCache* cache, int index) {
+	cache->slot[index] = -1;
+}
+
+void elite_free(EliteCache* cache) {
+	free(cache->members);
+	free(cache->indices);
+	free(cache->slot);
+	memset(cache, 0, sizeof(EliteCache));
+}
@@ -0,0 +1,45 @@
+#ifndef H_STORE_H
+#define H_STORE_H
+#include <stddef.h>
+#include "pgenalg.h"
+
+//Chromosomes prefetched at a time when streaming through the store
+#define STORE_WINDOW 64
+
+/*
+
+Both populations kept in a memory-mapped file instead of the heap, so a
+rank can hold more chromosomes than fit in RAM and let the kernel page
+them. Slots keep the fixed chromosome stride so the GA indexes them as
+before. Chromosomes are copied in with copy_chromosome, which writes only
+the genes in use, so pages past a chromosome's length are not dirtied by
+that write. A slot whose chromosome was ever longer keeps those pages.
+
+*/
+typedef struct {
+	int fd;
+	chromosome* base; //population then new_population
+	size_t bytes;
+	int count;
+} PopulationStore;
+
+//Copies of the fittest members, so parents drawn from them don't touch the store
+typedef struct {
+	int size;
+	int used;
+	chromosome* members;
+	int* slot; //cache slot of each population index, or -1
+	int* indices; //population index of each cache slot
+	int count;
+} EliteCache;
+
+int store_initialize(PopulationStore* store, const char* path, int count);
+chromosome* store_population(const PopulationStore* store, int which);
+void store_prefetch(const PopulationStore* store, const chromosome* first, int count);
+void store_free(PopulationStore* store);
+int elite_initialize(EliteCache* cache, int size, int count);
+void elite_fill(EliteCache* cache, const chromosome* population, const double* fitness);
+const chromosome* elite_lookup(const EliteCache* cache, const chromosome* population, int index);
+void elite_forget(EliteCache* cache, int index);
+void elite_free(EliteCache* cache);
+#endif
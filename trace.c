@@ -0,0 +1,192 @@
+/// trace.c
+//Timeline of thread and rank phases, written as a Chrome/Perfetto JSON trace
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include "trace.h"
+
+#define TRACE_TAG 6001
+
+static TraceRing* rings = NULL;
+static int nrings = 0;
+static double origin;
+static char trace_path[512];
+static MPI_Comm trace_comm;
+
+//Ring of the calling thread, NULL when tracing is off
+static __thread TraceRing* ring = NULL;
+
+//Span as sent to rank 0, names copied since other ranks map strings elsewhere
+typedef struct {
+	char name[TRACE_NAME];
+	int thread;
+	double start;
+	double end;
+} TraceRecord;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+
+Set up one ring per thread that records spans, and line the ranks' clocks
+up on a collective so every rank's spans share a time origin. Collective
+over comm, which trace_write gathers over too, and fails on every rank
+if it fails on any.
+
+*/
+int trace_initialize(const char* path, int count, int capacity, MPI_Comm comm) {
+	int i, ok, all;
+	unsigned long size = 1;
+	while (size < (unsigned long)capacity) size <<= 1;
+	rings = calloc(count, sizeof(TraceRing));
+	ok = (rings != NULL);
+	if (ok) nrings = count;
+	for (i = 0; ok && i < count; ++i) {
+		rings[i].capacity = size;
+		rings[i].events = malloc(size * sizeof(TraceEvent));
+		ok = (rings[i].events != NULL);
+	}
+	if (!ok) printf("error: could not allocate trace buffers\n");
+	snprintf(trace_path, sizeof(trace_path), "%s", path);
+	trace_comm = comm;
+	MPI_Allreduce(&ok, &all, 1, MPI_INT, MPI_MIN, comm);
+	origin = now();
+	if (!all) trace_discard();
+	return all;
+}
+
+//Record the calling thread's spans into ring index, shown as label if given
+void trace_thread(int index, const char* label) {
+	if (!rings || index >= nrings) return;
+	ring = &rings[index];
+	if (label) snprintf(ring->label, TRACE_NAME, "%s", label);
+}
+
+int trace_active() {
+	return ring != NULL;
+}
+
+//Start a span, returns 0 without reading the clock when tracing is off
+double trace_start() {
+	return ring ? now() : 0;
+}
+
+void trace_span(const char* name, double start) {
+	if (!ring) return;
+	TraceEvent* event = &ring->events[ring->written & (ring->capacity - 1)];
+	event->name = name;
+	event->start = start;
+	event->end = now();
+	ring->written++;
+}
+
+//Flatten this rank's rings, oldest surviving span first
+static TraceRecord* collect(int* count) {
+	int i;
+	unsigned long j, total = 0;
+	for (i = 0; i < nrings; ++i) {
+		total += (rings[i].written < rings[i].capacity) ? rings[i].written : rings[i].capacity;
+	}
+	TraceRecord* records = malloc((total + 1) * sizeof(TraceRecord));
+	*count = 0;
+	for (i = 0; i < nrings; ++i) {
+		TraceRing* r = &rings[i];
+		unsigned long first = (r->written > r->capacity) ? r->written - r->capacity : 0;
+		for (j = first; j < r->written; ++j) {
+			TraceRecord* record = &records[(*count)++];
+			const TraceEvent* event = &r->events[j & (r->capacity - 1)];
+			snprintf(record->name, TRACE_NAME, "%s", event->name);
+			record->thread = i;
+			record->start = event->start - origin;
+			record->end = event->end - origin;
+		}
+	}
+	return records;
+}
+
+static void write_records(FILE* out, int rank, const TraceRecord* records, int count, int* first) {
+	int i;
+	for (i = 0; i < count; ++i) {
+		fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			*first ? "" : ",", records[i].name, rank, records[i].thread,
+			records[i].start * 1e6, (records[i].end - records[i].start) * 1e6);
+		*first = 0;
+	}
+}
+
+//Drop the spans without writing them, for a job that stopped early, not collective
+void trace_discard() {
+	int i;
+	if (!rings) return;
+	for (i = 0; i < nrings; ++i) {
+		free(rings[i].events);
+	}
+	free(rings);
+	rings = NULL;
+	nrings = 0;
+	ring = NULL;
+}
+
+/*
+
+Send every rank's spans to rank 0, one rank at a time so rank 0 never
+holds more than one rank's worth, and write them out with ranks as
+processes and threads as tracks. Every thread must have stopped
+recording. Collective over the comm the trace was started on.
+
+*/
+void trace_write() {
+	int rank, ranks, count, i, r;
+	if (!rings) return;
+	MPI_Comm_rank(trace_comm, &rank);
+	MPI_Comm_size(trace_comm, &ranks);
+	TraceRecord* records = collect(&count);
+	if (rank != 0) {
+		MPI_Send(records, count * sizeof(TraceRecord), MPI_BYTE, 0, TRACE_TAG, trace_comm);
+	} else {
+		FILE* out = fopen(trace_path, "w");
+		if (!out) {
+			printf("error: could not open trace file %s\n", trace_path);
+		}
+		int first = 1;
+		if (out) {
+			fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+			for (r = 0; r < ranks; ++r) {
+				fprintf(out, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}",
+					first ? "" : ",", r, r);
+				first = 0;
+				for (i = 0; i < nrings; ++i) {
+					//tracks are laid out the same on every rank
+					char label[TRACE_NAME];
+					if (rings[i].label[0]) snprintf(label, TRACE_NAME, "%s", rings[i].label);
+					else snprintf(label, TRACE_NAME, "thread %d", i);
+					fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+						r, i, label);
+				}
+			}
+			write_records(out, 0, records, count, &first);
+		}
+		for (r = 1; r < ranks; ++r) {
+			MPI_Status status;
+			int bytes;
+			MPI_Probe(r, TRACE_TAG, trace_comm, &status);
+			MPI_Get_count(&status, MPI_BYTE, &bytes);
+			TraceRecord* received = malloc(bytes + sizeof(TraceRecord));
+			MPI_Recv(received, bytes, MPI_BYTE, r, TRACE_TAG, trace_comm, MPI_STATUS_IGNORE);
+			if (out) write_records(out, r, received, bytes / sizeof(TraceRecord), &first);
+			free(received);
+		}
+		if (out) {
+			fprintf(out, "\n]}\n");
+			fclose(out);
+		}
+	}
+	free(records);
+	trace_discard();
+}
@@ -0,0 +1,32 @@
+#ifndef H_TRACE_H
+#define H_TRACE_H
+
+//Longest span name kept when the trace is written
+#define TRACE_NAME 24
+
+//A finished span, named by a string that outlives the run
+typedef struct {
+	const char* name;
+	double start;
+	double end;
+} TraceEvent;
+
+//Spans of one thread, written only by that thread, oldest overwritten when full
+typedef struct {
+	TraceEvent* events;
+	unsigned long capacity; //power of two
+	unsigned long written;
+	char label[TRACE_NAME]; //track name, "thread <index>" when empty
+} TraceRing;
+
+//Only seen by files that include mpi.h first, the spans below need no MPI
+#ifdef MPI_VERSION
+int trace_initialize(const char* path, int rings, int capacity, MPI_Comm comm);
+#endif
+void trace_thread(int ring, const char* label);
+int trace_active();
+double trace_start();
+void trace_span(const char* name, double start);
+void trace_write();
+void trace_discard();
+#endif